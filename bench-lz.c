@@ -0,0 +1,82 @@
+/*
+**  LZ compressor benchmark
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Compresses a sample log from flash, with PB4 high while lz_char()
+**  and lz_flush() run, and throws the output away. Then sends:
+**
+**    lz: 1472 bytes in, 275 out
+**    done
+**
+**  Under simavr, 'sim-loopback -b' adds up the time PB4 was high,
+**  which 'make lz-bench' divides by the bytes in to give cycles per
+**  byte.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "fd-serial.h"
+#include "serial-fmt.h"
+#include "lz.h"
+
+#define MARK_PIN (1<<PORTB4)
+
+// Status lines like those of example-send and serial-example
+
+static const char sample_P[] PROGMEM =
+	"ATtiny85 Serial Port Test 9600BPS UUUUU UUUUU\n"
+	"C 0C 20\n"
+	"W01:3A 02:3B 03:3D \n"
+	"ATtiny85 Serial Port Test 9600BPS UUUUU UUUUU\n"
+	"C 0C 21\n"
+	"<41 42 43 0D >C 0C 22\n";
+
+#define PASSES 8
+
+static uint16_t packed;
+
+void lz_out(unsigned char c) {
+	packed ++;
+}
+
+void set_cpu_8mhz(void) {
+	CLKPR = 1<<CLKPCE;
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+}
+
+int main(void) {
+	uint16_t plain = 0;
+
+	cli();
+	set_cpu_8mhz();
+	fdserial_init();
+	DDRB |= MARK_PIN;
+	sei();
+
+	for (uint8_t pass = 0; pass < PASSES; ++pass) {
+		const char *p = sample_P;
+		char c;
+
+		while ((c = pgm_read_byte(p++))) {
+			PORTB |= MARK_PIN;
+			lz_char(c);
+			if (c == '\n') {
+				lz_flush();
+			}
+			PORTB &= ~MARK_PIN;
+			plain ++;
+		}
+	}
+
+	fmt_string("lz: ");
+	fmt_dec(plain);
+	fmt_string(" bytes in, ");
+	fmt_dec(packed);
+	fmt_string(" out\r\ndone\r\n");
+	fmt_flush();
+
+	while (1) { }
+}
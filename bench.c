@@ -0,0 +1,128 @@
+/*
+**  Serial backend benchmark
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Build with SERIAL_BACKEND set (see serial.h). Using the watchdog
+**  interrupt as a clock, this counts how often the main loop goes
+**  round while the UART is idle, then sends BENCH_BYTES bytes back
+**  to back and counts again. The main loop time lost is the CPU
+**  used by the UART. Bytes received meanwhile are counted, so with
+**  TX wired to RX a full duplex backend also shows its receive cost.
+**  The result is sent when done:
+**
+**    bench fd-serial: 1024 bytes in 68 ticks, 941 bytes/s, cpu 21%, rx 0
+**    done
+**
+**  A tick is the watchdog's nominal 16 ms, and its oscillator is only
+**  good to 10% or so; compare backends on one chip, or under simavr
+**  with 'make bench', which also shows flash and RAM.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "serial.h"
+#include "serial-fmt.h"
+
+#ifndef BENCH_BYTES
+#define BENCH_BYTES 1024
+#endif
+
+// Idle loop measurement, in ticks
+#define BENCH_TICKS 32
+
+#define TICK_MS 16
+
+static volatile uint8_t ticks;
+
+/* Set highest frequency CPU operation
+**  Startup frequency is assumed to be 1 MHz
+**  8 MHz for the internal clock
+*/
+
+void set_cpu_8mhz(void) {
+	CLKPR = 1<<CLKPCE;
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+}
+
+/*
+**  Watchdog in interrupt mode, every 16 ms
+*/
+
+static void tick_init(void) {
+	MCUSR &= ~( 1<<WDRF );
+	WDTCR = 1<<WDCE | 1<<WDE;
+	WDTCR = 1<<WDIE;
+}
+
+ISR(WDT_vect) {
+	ticks ++;
+}
+
+static uint8_t tick_edge(void) {
+	uint8_t t = ticks;
+
+	while (ticks == t) { }
+	return ticks;
+}
+
+int main(void) {
+	uint32_t idle_loops = 0;
+	uint32_t busy_loops = 0;
+	uint16_t left = BENCH_BYTES;
+	uint16_t rx = 0;
+	unsigned char c = ' ';
+
+	cli();
+	set_cpu_8mhz();
+	serial_init();
+	tick_init();
+	sei();
+
+	// The idle loop does the same checks as the busy loop
+	uint8_t start = tick_edge();
+	while ((uint8_t) (ticks - start) < BENCH_TICKS) {
+		if (serial_available()) {
+			serial_recv();
+		}
+		idle_loops ++;
+	}
+
+	start = tick_edge();
+	while (left || ! serial_sendok()) {
+		if (left && serial_sendok()) {
+			serial_send(c);
+			c = c == '~' ? ' ' : c + 1;
+			left --;
+		}
+		if (serial_available()) {
+			serial_recv();
+			rx ++;
+		}
+		busy_loops ++;
+	}
+	uint8_t elapsed = ticks - start;
+
+	// Main loop time left for the application, as a percentage. With
+	// tick jitter the busy loop can go round more often than expected,
+	// so keep that to 100%. These divides run once, after timing.
+	uint32_t expected = idle_loops * elapsed / BENCH_TICKS;
+	uint32_t left_pct = expected ? busy_loops * 100 / expected : 100;
+	uint8_t cpu = left_pct < 100 ? 100 - (uint8_t) left_pct : 0;
+
+	fmt_string("\r\nbench " SERIAL_NAME ": ");
+	fmt_dec(BENCH_BYTES);
+	fmt_string(" bytes in ");
+	fmt_dec(elapsed);
+	fmt_string(" ticks, ");
+	fmt_dec(elapsed ? (uint32_t) BENCH_BYTES * 1000 / (elapsed * TICK_MS) : 0);
+	fmt_string(" bytes/s, cpu ");
+	fmt_dec(cpu);
+	fmt_string("%, rx ");
+	fmt_dec(rx);
+	fmt_string("\r\ndone\r\n");
+	fmt_flush();
+
+	while (1) { }
+}
@@ -45,6 +45,11 @@ int main(void) {
 
 	writeString("\r\nFull Duplex Serial example: receive and echo\r\n");
 
+#ifdef RX_BRIDGE
+	// Echo from the rx ISR; nothing is left for the main loop
+	fdserial_bridge(FD_BRIDGE_FORWARD, 0, 0);
+#endif
+
 	while (1) {
 		// Wait for a RX character and return it
 
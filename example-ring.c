@@ -6,6 +6,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 
 #include "fd-serial.h"
 
@@ -45,8 +46,29 @@ int main(void) {
 
 	writeString("\r\nFull Duplex Serial example: ring buffer\r\n");
 
+#ifdef RX_WATERMARK
+	set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+
 	while (1) {
+#ifdef RX_WATERMARK
+		// Sleep until the rx ISR says RX_WATERMARK chars are waiting.
+		// sei() delays interrupts by one instruction, so an event
+		// raised after the check still wakes us from sleep_cpu().
+		cli();
+		uint8_t events = fdserial_events();
+		if (! events) {
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+
+		if (events & FD_EVENT_WATERMARK) {
+#else
 		if (fdserial_available() >= 5) {
+#endif
 			// Read and echo all chars
 			while (fdserial_available()) {
 				// Wait for a RX character and return it
@@ -7,6 +7,7 @@
 #include <avr/interrupt.h>
 
 #include "fd-serial.h"
+#include "serial-fmt.h"
 
 /* Set highest frequency CPU operation
 **  Startup frequency is assumed to be 1 MHz
@@ -20,29 +21,6 @@ void set_cpu_8mhz(void) {
 	// System clock is now 8 MHz
 }
 
-void writeString(char const *cp) {
-	while (*cp) {
-		fdserial_send(*cp++);
-	}
-}
-
-void write8(unsigned char c) {
-	unsigned char b = (c >> 4) + 0x30;
-	fdserial_send(b > 0x39 ? b + 7 : b);
-	b = (c & 0x0f) + 0x30;
-	fdserial_send(b > 0x39 ? b + 7 : b);
-}
-
-void write16(uint16_t i) {
-	write8(i >> 8);
-	write8(i & 0xff);
-}
-
-void write32(uint32_t i) {
-	write16(i >> 16);
-	write16(i & 0xffff);
-}
-
 volatile uint8_t count_int0 = 0;
 volatile uint8_t start_cycles = 0;
 volatile uint8_t start_counter = 0;
@@ -79,7 +57,8 @@ int main(void)
 
 		if (loops % 50000 == 0) {
 			PORTB |= 1<<PORTB4;
-			writeString("ATtiny85 Serial Port Test 9600BPS UUUUU UUUUU\n");
+			fmt_string("ATtiny85 Serial Port Test 9600BPS UUUUU UUUUU\n");
+			fmt_flush();
 			PORTB &= ~(1<<PORTB4);
 		}
 	}
@@ -0,0 +1,67 @@
+/*
+**  Demonstration of the SoftUart template
+**  (C) 2010, Nick Andrew <nick@tull.net>
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "soft-uart.hpp"
+
+using softuart::SoftUart;
+
+// Same pins and rate as fd-serial, 20 byte rx ring, 8 byte tx ring.
+// 'make softuart-size' builds it with no tx ring, as fd-serial has.
+#ifndef SOFTUART_TXBUF
+#define SOFTUART_TXBUF 8
+#endif
+
+typedef SoftUart<PB2, PB3, 9600, 20, SOFTUART_TXBUF> Uart;
+
+SOFTUART_ISRS(Uart)
+
+/*  Set highest frequency CPU operation.
+**  Startup frequency is assumed to be 1 MHz;
+**  8 MHz for the internal clock.
+*/
+
+void set_cpu_8mhz(void) {
+	// Prepare for clock change
+	CLKPR = 1<<CLKPCE;
+	// Set the internal clock
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+	// System clock is now 8 MHz
+}
+
+void writeString(char const *cp) {
+	while (*cp) {
+		Uart::send(*cp++);
+	}
+}
+
+int main(void) {
+	// Disable interrupts
+	cli();
+
+	// Setup the clock
+	set_cpu_8mhz();
+
+	// Enable the software UART
+	Uart::init();
+
+	// Enable interrupts
+	sei();
+
+	writeString("\r\nSoftUart example: receive and echo\r\n");
+
+	while (1) {
+		// Wait for a RX character and return it
+
+		char c = Uart::recv();
+
+		// If a non-null character was received, queue it for TX
+		if (c) {
+			Uart::send(c);
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/*
+**  Demonstration of fd-serial with cooperative tasks
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  One task echoes received characters while another flashes
+**  an LED on PB4 and sends a count every second. Neither polls;
+**  the CPU sleeps until one of them has something to do.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "fd-serial.h"
+#include "fd-task.h"
+
+#define LED_PIN (1<<PORTB4)
+
+/*  Set highest frequency CPU operation.
+**  Startup frequency is assumed to be 1 MHz;
+**  8 MHz for the internal clock.
+*/
+
+void set_cpu_8mhz(void) {
+	// Prepare for clock change
+	CLKPR = 1<<CLKPCE;
+	// Set the internal clock
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+	// System clock is now 8 MHz
+}
+
+TASK(echo) {
+	static char c;
+
+	TASK_BEGIN();
+
+	while (1) {
+		await_rx(1);
+		c = fdserial_recv();
+
+		await_tx_space();
+		fdserial_send(c);
+	}
+
+	TASK_END();
+}
+
+TASK(heartbeat) {
+	static uint8_t count;
+	static const char *cp;
+	static char digits[4];
+
+	TASK_BEGIN();
+
+	while (1) {
+		await_timeout(FD_TASK_MS(1000));
+		PORTB ^= LED_PIN;
+
+		count ++;
+		digits[0] = '0' + count / 100;
+		digits[1] = '0' + count / 10 % 10;
+		digits[2] = '0' + count % 10;
+		digits[3] = ' ';
+
+		// Send without waiting inside fdserial_send()
+		for (cp = digits; cp < digits + sizeof(digits); ++cp) {
+			await_tx_space();
+			fdserial_send(*cp);
+		}
+	}
+
+	TASK_END();
+}
+
+static struct fd_task echo_task;
+static struct fd_task heartbeat_task;
+
+int main(void) {
+	// Disable interrupts
+	cli();
+
+	// Setup the clock
+	set_cpu_8mhz();
+
+	DDRB |= LED_PIN;
+
+	// Enable the software UART and the tick
+	fdserial_init();
+	fd_task_init();
+
+	fd_task_add(&echo_task, echo);
+	fd_task_add(&heartbeat_task, heartbeat);
+
+	// Enable interrupts
+	sei();
+
+	fd_task_run();
+
+	return 0;
+}
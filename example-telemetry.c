@@ -0,0 +1,57 @@
+/*
+**  Demonstration of binary telemetry over fd-serial
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Sends the ADC reading of PB4, the internal temperature sensor and
+**  a sample count as a telemetry record about ten times a second.
+**  Decode with:
+**
+**     host/telemetry-decode -s 1:3 < /dev/ttyUSB0
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "fd-serial.h"
+#include "serial-fmt.h"
+#include "telemetry.h"
+
+/* Set highest frequency CPU operation
+**  Startup frequency is assumed to be 1 MHz
+**  8 MHz for the internal clock
+*/
+
+void set_cpu_8mhz(void) {
+	CLKPR = 1<<CLKPCE;
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+}
+
+/*
+**  Read an ADC channel against the 1.1V reference, ADC clock 125 kHz
+*/
+
+int16_t read_adc(uint8_t mux) {
+	ADMUX = 1<<REFS1 | mux;
+	ADCSRA = 1<<ADEN | 1<<ADSC | 1<<ADPS2 | 1<<ADPS1;
+	while (ADCSRA & (1<<ADSC)) { }
+	return ADC;
+}
+
+TELEMETRY_SCHEMA(sample, 1, 3);
+
+int main(void) {
+	int16_t v[3] = { 0, 0, 0 };
+
+	cli();
+	set_cpu_8mhz();
+	fdserial_init();
+	sei();
+
+	while (1) {
+		v[0] = read_adc(2);     // ADC2 is PB4
+		v[1] = read_adc(15);    // Temperature sensor
+		v[2] ++;
+		telemetry_send(&sample, v);
+		fdserial_delay(100);
+	}
+}
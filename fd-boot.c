@@ -0,0 +1,296 @@
+/*
+**  Tullnet serial bootloader for the ATtiny85
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Lives at BOOT_START, at the top of flash, and talks to
+**  host/fd-upload over fd-serial at BOOT_RATE. The ATtiny85 has no
+**  boot section and one vector table, which belongs to the
+**  application, so fd-serial is built with FD_POLLED and interrupts
+**  stay off.
+**
+**  The chip's reset vector always points here. When page 0 of an
+**  application is written, its reset vector is moved into the page
+**  below the bootloader (the trampoline page, which the application
+**  may not use), and replaced with a jump to BOOT_START. The first
+**  page written in a session erases the trampoline page, so that a
+**  half loaded application is never started, and the host sends
+**  page 0 last, so that until then the old reset vector still leads
+**  here.
+**
+**  After reset the bootloader waits BOOT_WAIT ticks of 32.8 ms for
+**  an 'S' from the host, then starts the application if there is one.
+**
+**  Commands, answered with one byte unless shown:
+**
+**    'S'                  'S', page size, trampoline address (2 bytes, LE)
+**    'P' addr(2, LE) data(page size) crc(2, high byte first)
+**                         'K' written and read back
+**                         'C' CRC error, 'A' bad address, 'V' verify failed
+**    'G'                  'G' and start the application, or 'N' if none
+**
+**  The CRC is CRC-16/CCITT (poly 0x1021, init 0xffff) over the address
+**  and data, as RUNNING_CRC 16 in fd-serial. The host sends each page
+**  once the previous one is answered. That is also the flow control:
+**  the CPU is halted while SPM erases and writes a page (about 4.5 ms
+**  each) and cannot receive, so a page cannot be taken in while the
+**  last one is written.
+*/
+
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "fd-serial.h"
+
+#ifndef FD_POLLED
+#error "fd-serial must be compiled with FD_POLLED for fd-boot"
+#endif
+
+#ifndef BOOT_START
+#define BOOT_START 0x1800
+#endif
+
+// Timer0 ticks (1024 prescale, 256 counts) to wait for the host
+#ifndef BOOT_WAIT
+#define BOOT_WAIT 16
+#endif
+
+// Ticks of silence which end a page part way
+#define BYTE_WAIT 4
+
+#define PAGE       SPM_PAGESIZE
+#define TRAMPOLINE (BOOT_START - PAGE)
+
+#define RJMP       0xc000
+
+#if BOOT_START % PAGE
+#error "BOOT_START must be on a page boundary"
+#endif
+
+/*
+**  A newly programmed chip starts at address 0; the Makefile puts
+**  this section there.
+*/
+
+__asm__ (
+	".section .bootreset,\"ax\",@progbits\n"
+	"\trjmp __vectors\n"
+	"\t.previous\n"
+);
+
+static uint8_t page[PAGE];
+
+// The trampoline page has been erased in this session
+static uint8_t erased;
+
+void set_cpu_8mhz(void) {
+	CLKPR = 1<<CLKPCE;
+	CLKPR = 0<<CLKPS3 | 0<<CLKPS2 | 0<<CLKPS1 | 0<<CLKPS0;
+}
+
+/*
+**  CRC-16/CCITT a nibble at a time, as RUNNING_CRC 16 in fd-serial.
+**  fd-serial is polled here, so this runs between polls and must be
+**  short next to a bit time: a bit at a time took half of one at
+**  38400.
+*/
+
+static const uint16_t crc_nibble[16] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+static uint16_t _crc(uint16_t crc, uint8_t c) {
+	crc = (crc << 4) ^ pgm_read_word(&crc_nibble[(crc >> 12) ^ (c >> 4)]);
+	crc = (crc << 4) ^ pgm_read_word(&crc_nibble[(crc >> 12) ^ (c & 0x0f)]);
+	return crc;
+}
+
+/*
+**  _recv(ticks)
+**    Return the next byte, or -1 after ticks of Timer0 overflows
+**    with nothing received. 0 waits for ever.
+*/
+
+static int16_t _recv(uint8_t ticks) {
+	while (! fdserial_available()) {
+		fdserial_poll();
+		if (TIFR & 1<<TOV0) {
+			TIFR = 1<<TOV0;
+			if (ticks && ! --ticks) {
+				return -1;
+			}
+		}
+	}
+	return fdserial_recv();
+}
+
+/*
+**  rjmp k at word address from goes to from + 1 + k, modulo the
+**  4K words of flash.
+*/
+
+static uint16_t _rjmp(uint16_t from, uint16_t to) {
+	return RJMP | ((to - from - 1) & 0x0fff);
+}
+
+static uint8_t _have_app(void) {
+	return pgm_read_word(TRAMPOLINE) != 0xffff;
+}
+
+/*
+**  _program(addr, data)
+**    Erase and write one page, and read it back.
+*/
+
+static uint8_t _program(uint16_t addr, const uint8_t *data) {
+	boot_page_erase(addr);
+	boot_spm_busy_wait();
+
+	for (uint8_t i = 0; i < PAGE; i += 2) {
+		boot_page_fill(addr + i, data[i] | data[i + 1] << 8);
+	}
+	boot_page_write(addr);
+	boot_spm_busy_wait();
+
+	for (uint8_t i = 0; i < PAGE; ++i) {
+		if (pgm_read_byte(addr + i) != data[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+**  _write_page(addr)
+**    Write the received page, redirecting the reset vector if it
+**    is page 0. Return the answer for the host.
+*/
+
+static uint8_t _write_page(uint16_t addr) {
+	if (addr % PAGE || addr >= TRAMPOLINE) {
+		return 'A';
+	}
+
+	if (! erased) {
+		boot_page_erase(TRAMPOLINE);
+		boot_spm_busy_wait();
+		erased = 1;
+	}
+
+	if (addr == 0) {
+		uint16_t vector = page[0] | page[1] << 8;
+
+		if ((vector & 0xf000) != RJMP) {
+			return 'A';
+		}
+
+		// The application's reset target, as a word address
+		uint16_t target = (1 + vector) & 0x0fff;
+		uint8_t tramp[PAGE];
+		uint16_t jump = _rjmp(TRAMPOLINE / 2, target);
+
+		for (uint8_t i = 0; i < PAGE; ++i) {
+			tramp[i] = 0xff;
+		}
+		tramp[0] = jump;
+		tramp[1] = jump >> 8;
+		if (! _program(TRAMPOLINE, tramp)) {
+			return 'V';
+		}
+
+		jump = _rjmp(0, BOOT_START / 2);
+		page[0] = jump;
+		page[1] = jump >> 8;
+	}
+
+	return _program(addr, page) ? 'K' : 'V';
+}
+
+static void _start_app(void) {
+	// Let the last reply go out, then put things back as at reset
+	fdserial_delay(1);
+	TCCR1 = 0;
+	TIMSK = 0;
+	GIMSK = 0;
+	TCCR0B = 0;
+	TIFR = 0xff;
+	GIFR = 0xff;
+	DDRB = 0;
+	PORTB = 0;
+
+	((void (*)(void)) (TRAMPOLINE / 2))();
+}
+
+int main(void) {
+	uint8_t synced = 0;
+
+	set_cpu_8mhz();
+	fdserial_init();
+
+	// Timer0 only counts time here
+	TCCR0A = 0;
+	TCCR0B = 1<<CS02 | 1<<CS00;
+
+	while (1) {
+		int16_t c = _recv(synced ? 0 : BOOT_WAIT);
+
+		if (c < 0) {
+			if (_have_app()) {
+				_start_app();
+			}
+			// No application: wait for the host forever
+			synced = 1;
+			continue;
+		}
+
+		switch (c) {
+			case 'S':
+				synced = 1;
+				fdserial_send('S');
+				fdserial_send(PAGE);
+				fdserial_send(TRAMPOLINE & 0xff);
+				fdserial_send(TRAMPOLINE >> 8);
+				break;
+
+			case 'P': {
+				uint16_t crc = 0xffff;
+				uint16_t addr = 0;
+				int16_t b;
+				uint8_t i;
+
+				for (i = 0; i < 2 + PAGE + 2; ++i) {
+					if ((b = _recv(BYTE_WAIT)) < 0) {
+						break;
+					}
+					if (i < 2) {
+						addr |= b << (i * 8);
+					} else if (i < 2 + PAGE) {
+						page[i - 2] = b;
+					}
+					if (i < 2 + PAGE) {
+						crc = _crc(crc, b);
+					} else {
+						crc ^= (uint16_t) b << (i == 2 + PAGE ? 8 : 0);
+					}
+				}
+
+				if (b < 0) {
+					// The host gave up part way; it will send 'S' again
+					break;
+				}
+				fdserial_send(crc ? 'C' : _write_page(addr));
+				break;
+			}
+
+			case 'G':
+				if (_have_app()) {
+					fdserial_send('G');
+					_start_app();
+				}
+				fdserial_send('N');
+				break;
+		}
+	}
+}
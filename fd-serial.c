@@ -6,35 +6,171 @@
 **     This code uses Timer/Counter 1
 **     RX is connected to PORTB2 (INT0), pin 7
 **     TX is connected to PORTB3, pin 2
-**     Speed 9600 bps, full duplex
+**     Speed SERIAL_RATE (default 9600 bps), full duplex
 */
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <stdint.h>
 
 #include "fd-serial.h"
+#ifdef FD_TASK
+#include "fd-task.h"
+#endif
 
 #ifndef CPU_FREQ
 #define CPU_FREQ 8000000
 #endif
 
-#if SERIAL_RATE == 9600
-// Prescaler CK/4
-#define PRESCALER (1<<CS11 | 1<<CS10)
+// Timer1 ticks in one bit time, rounded, for a prescaler divisor
+#define SERIAL_TICKS(div) ((CPU_FREQ + (div) * SERIAL_RATE / 2) / ((div) * SERIAL_RATE))
+
+// Use the smallest prescaler which lets a bit time fit in 8 bits.
+// The CS1 bits select CK / 2^(n-1). At 8 MHz and 9600 bps this is
+// CK/4, with 208 ticks (208.333) per bit.
+#if SERIAL_TICKS(1) <= 256
+#define PRESCALER_BITS 1
+#define PRESCALER_DIVISOR 1
+#elif SERIAL_TICKS(2) <= 256
+#define PRESCALER_BITS 2
+#define PRESCALER_DIVISOR 2
+#elif SERIAL_TICKS(4) <= 256
+#define PRESCALER_BITS 3
 #define PRESCALER_DIVISOR 4
-// 8000000 / PRESCALER / 9600 = 208.333
-#define SERIAL_TOP 207
-#define SERIAL_HALFBIT 104
+#elif SERIAL_TICKS(8) <= 256
+#define PRESCALER_BITS 4
+#define PRESCALER_DIVISOR 8
+#elif SERIAL_TICKS(16) <= 256
+#define PRESCALER_BITS 5
+#define PRESCALER_DIVISOR 16
+#elif SERIAL_TICKS(32) <= 256
+#define PRESCALER_BITS 6
+#define PRESCALER_DIVISOR 32
+#elif SERIAL_TICKS(64) <= 256
+#define PRESCALER_BITS 7
+#define PRESCALER_DIVISOR 64
+#elif SERIAL_TICKS(128) <= 256
+#define PRESCALER_BITS 8
+#define PRESCALER_DIVISOR 128
+#elif SERIAL_TICKS(256) <= 256
+#define PRESCALER_BITS 9
+#define PRESCALER_DIVISOR 256
+#else
+#error "SERIAL_RATE is too slow for CPU_FREQ"
+#endif
+
+#define PRESCALER (PRESCALER_BITS << CS10)
+#define SERIAL_TOP (SERIAL_TICKS(PRESCALER_DIVISOR) - 1)
+#define SERIAL_HALFBIT ((SERIAL_TOP + 1) / 2)
+
+#if SERIAL_TOP < 16
+#error "SERIAL_RATE is too fast for CPU_FREQ"
+#endif
+
+// The bit time must be within 2% of SERIAL_RATE
+#define SERIAL_ACTUAL (PRESCALER_DIVISOR * (SERIAL_TOP + 1) * SERIAL_RATE)
+#if SERIAL_ACTUAL - CPU_FREQ > CPU_FREQ / 50 || CPU_FREQ - SERIAL_ACTUAL > CPU_FREQ / 50
+#error "SERIAL_RATE cannot be made within 2% from CPU_FREQ"
+#endif
+
+// Bits between the start and stop bits
+#ifdef MULTIDROP
+#define FRAME_BITS 9
+#elif FD_PARITY
+#define FRAME_BITS (FD_DATA_BITS + 1)
+#else
+#define FRAME_BITS FD_DATA_BITS
+#endif
+
+// Starting value of send_par and recv_par. Even and odd parity are
+// then updated with each data bit; mark and space are constant.
+#if FD_PARITY == FD_PARITY_ODD || FD_PARITY == FD_PARITY_MARK
+#define PARITY_INIT 1
+#else
+#define PARITY_INIT 0
+#endif
+#if FD_PARITY == FD_PARITY_EVEN || FD_PARITY == FD_PARITY_ODD
+#define PARITY_XOR
+#endif
+
+#ifdef LIN_SLAVE
+// lin_phase values
+#define LIN_IDLE 0 // Wait for a break
+#define LIN_SYNC 1 // Timing the sync field
+#define LIN_PID  2 // Next byte is the PID
+#define LIN_DATA 3 // Receiving data and checksum
+#define LIN_ECHO 4 // Hearing our own response
 
+// Give up on the sync field after this many bit times
+#define LIN_SYNC_WRAPS 24
+#endif
+
+/*
+**  With FD_POLLED the handlers are plain functions, called by
+**  fdserial_poll(), and waiting loops call fdserial_poll().
+*/
+
+#ifdef FD_POLLED
+#define FD_HANDLER(vector, name) static void name(void)
+#define _poll_wait() fdserial_poll()
 #else
-#error "Serial rates other than 9600 are not presently supported"
+#define FD_HANDLER(vector, name) ISR(vector)
+#define _poll_wait()
 #endif
 
 /* Data structure used by this module */
 
 static struct fd_uart fd_uart1;
 
+/*
+**  The state used by the ISRs on every bit. With FD_COMPACT the two
+**  state bytes are GPIOR0 and GPIOR1, the flags are bits of GPIOR2,
+**  and the bit counters are the two halves of one byte. The GPIORs
+**  are in the low I/O space: reading one is a single in, and setting
+**  or clearing a flag is a single sbi or cbi, which needs no cli().
+**  The bit counters are only touched by the ISRs, which do not nest.
+*/
+
+#ifdef FD_COMPACT
+#define TX_STATE GPIOR0
+#define RX_STATE GPIOR1
+
+#define FLAG_AVAILABLE  (1<<0)
+#define FLAG_SEND_READY (1<<1)
+
+#define AVAILABLE          (GPIOR2 & FLAG_AVAILABLE)
+#define SET_AVAILABLE()    (GPIOR2 |= FLAG_AVAILABLE)
+#define CLEAR_AVAILABLE()  (GPIOR2 &= ~FLAG_AVAILABLE)
+#define SEND_READY         (GPIOR2 & FLAG_SEND_READY)
+#define SET_SEND_READY()   (GPIOR2 |= FLAG_SEND_READY)
+#define CLEAR_SEND_READY() (GPIOR2 &= ~FLAG_SEND_READY)
+
+#define SEND_BITS          (fd_uart1.bits & 0x0f)
+#define SET_SEND_BITS(n)   (fd_uart1.bits = (fd_uart1.bits & 0xf0) | (n))
+#define DEC_SEND_BITS()    ((fd_uart1.bits -= 0x01) & 0x0f)
+#define RECV_BITS          (fd_uart1.bits >> 4)
+#define SET_RECV_BITS(n)   (fd_uart1.bits = (fd_uart1.bits & 0x0f) | (n) << 4)
+#define DEC_RECV_BITS()    ((fd_uart1.bits -= 0x10) & 0xf0)
+#else
+#define TX_STATE fd_uart1.tx_state
+#define RX_STATE fd_uart1.rx_state
+
+#define AVAILABLE          fd_uart1.available
+#define SET_AVAILABLE()    (fd_uart1.available = 1)
+#define CLEAR_AVAILABLE()  (fd_uart1.available = 0)
+#define SEND_READY         fd_uart1.send_ready
+#define SET_SEND_READY()   (fd_uart1.send_ready = 1)
+#define CLEAR_SEND_READY() (fd_uart1.send_ready = 0)
+
+#define SEND_BITS          fd_uart1.send_bits
+#define SET_SEND_BITS(n)   (fd_uart1.send_bits = (n))
+#define DEC_SEND_BITS()    (--fd_uart1.send_bits)
+#define RECV_BITS          fd_uart1.recv_bits
+#define SET_RECV_BITS(n)   (fd_uart1.recv_bits = (n))
+#define DEC_RECV_BITS()    (--fd_uart1.recv_bits)
+#endif
+
 /*
 **  Start the timer. The timer must be running while characters
 **  are being received or sent.
@@ -60,8 +196,9 @@ static void _stoptimer(void) {
 */
 
 inline void _enable_int0(void) {
-	// Clear any pending INT0
-	GIFR |= 1<<INTF0;
+	// Clear any pending INT0. Flags are cleared by writing 1, so
+	// don't read-modify-write.
+	GIFR = 1<<INTF0;
 	// Enable INT0
 	GIMSK |= 1<<INT0;
 }
@@ -96,8 +233,8 @@ inline void _stop_tx(void) {
 */
 
 inline void _start_rx(void) {
-	// Clear pending RX timer interrupt
-	TIFR |= 1<<OCF1B;
+	// Clear pending RX timer interrupt, leaving OCF1A alone
+	TIFR = 1<<OCF1B;
 	// Enable TIMER_COMP1B
 	TIMSK |= 1<<OCIE1B;
 }
@@ -110,306 +247,2156 @@ inline void _stop_rx(void) {
 	TIMSK &= ~( 1<<OCIE1B );
 }
 
+#ifdef RING_BUFFER
 /*
-**  Initialise the software UART.
-**
-**  Configure timer1 as follows:
-**    1 interrupts per data bit
-**    CTC mode (CTC1=1)
-**    No output pin
-**    Frequency = 8000000 / 4 / 208 = 9615 bits/sec
-**    Prescaler = 4, Clock source = System clock, OCR1C = 207
-**  Configure INT0 so an interrupt occurs on the falling edge
-**    of INT0 (pin 7)
+**  Count of chars in the rx ring buffer
 */
 
-void fdserial_init(void) {
-	uint8_t com_mode = 0<<COM1A1 | 0<<COM1A0;
-	uint8_t ctc_mode = 1<<CTC1;
-
-	fd_uart1.send_ready = 1;
-	fd_uart1.tx_state = 0;
+static inline uint8_t _rx_count(void) {
+	uint8_t head = fd_uart1.rx_head;
+	uint8_t tail = fd_uart1.rx_tail;
 
-	fd_uart1.available = 0;
-	fd_uart1.rx_state = 0;
+	// Not a signed difference: char is unsigned here, and
+	// RING_BUFFER may be over 127
+	if (head >= tail) {
+		return head - tail;
+	}
 
-#ifdef RING_BUFFER
-	fd_uart1.rx_head = 0;
-	fd_uart1.rx_tail = 0;
+	return head + RING_BUFFER - tail;
+}
 #endif
 
-	// Configure INT0 to interrupt on falling edge
-	MCUCR |= 1<<ISC01;
-
-	TCNT1 = 0;
-	OCR1A = 16; // this will be used for send bit timing
-	OCR1B = 32; // this will be used for receive bit timing
-	OCR1C = SERIAL_TOP;
+#ifdef RUNNING_CRC
+#define CRC_BYTES (RUNNING_CRC / 8)
 
-	// Configure pin PORTB3 as an output, and raise it
-	DDRB |= S1_TX_PIN;
-	PORTB |= S1_TX_PIN;
+/*
+**  CRC of each nibble value, for updating the CRC 4 bits at a time
+*/
 
-	// Configure pin PORTB2 as an input, and enable pullup
-	DDRB &= ~( S1_RX_PIN );
-	PORTB |= S1_RX_PIN;
+#if RUNNING_CRC == 16
+static const uint16_t crc_nibble[16] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
 
-	_stoptimer();
-	TCCR1 = ctc_mode | com_mode;
-	_starttimer();
-	_enable_int0();
+static inline fdserial_crc_t _crc_update(fdserial_crc_t crc, unsigned char c) {
+	crc = (crc << 4) ^ pgm_read_word(&crc_nibble[(crc >> 12) ^ (c >> 4)]);
+	crc = (crc << 4) ^ pgm_read_word(&crc_nibble[(crc >> 12) ^ (c & 0x0f)]);
+	return crc;
 }
+#else
+static const uint8_t crc_nibble[16] PROGMEM = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+	0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d
+};
+
+static inline fdserial_crc_t _crc_update(fdserial_crc_t crc, unsigned char c) {
+	crc = (crc << 4) ^ pgm_read_byte(&crc_nibble[(crc >> 4) ^ (c >> 4)]);
+	crc = (crc << 4) ^ pgm_read_byte(&crc_nibble[(crc >> 4) ^ (c & 0x0f)]);
+	return crc;
+}
+#endif
+#else
+#define CRC_BYTES 0
+#endif
 
 /*
-**  fdserial_available()
-**    Return true if a character has been received on the receive interface.
+**  Start sending from idle. The first bit goes out one timer
+**  cycle from now. Call with interrupts disabled.
 */
 
-uint8_t fdserial_available(void) {
-#ifdef RING_BUFFER
-	char d = fd_uart1.rx_head - fd_uart1.rx_tail;
-	if (d < 0) {
-		return d + RING_BUFFER;
-	}
+static void _tx_wakeup(void) {
+	OCR1A = TCNT1;
+	TX_STATE = 1;
+	_start_tx();
+}
 
-	return d;
-#else
-	return fd_uart1.available;
+/*
+**  Return to idle. Call with interrupts disabled.
+*/
+
+static inline void _tx_idle(void) {
+#ifdef RS485_DE_PIN
+	// Release the bus
+	PORTB &= ~( RS485_DE_PIN );
 #endif
+	TX_STATE = 0;
+	_stop_tx();
 }
 
+#ifdef TX_FLOW_CONTROL
 /*
-**  fdserial_sendok()
-**    Return true if the transmit interface is free to transmit a character.
+**  True if the receiver at the other end has asked us to stop.
 */
 
-uint8_t fdserial_sendok(void) {
-	return fd_uart1.send_ready;
+static inline uint8_t _tx_paused(void) {
+#ifdef FLOW_CTS_PIN
+	if (PINB & FLOW_CTS_PIN) {
+		return 1;
+	}
+#endif
+#ifdef XON_XOFF
+	if (fd_uart1.tx_paused) {
+		return 1;
+	}
+#endif
+	return 0;
 }
+#endif
 
+#ifdef SEND_BUFFER
 /*
-**  fdserial_send(c)
-**    Send the character c.
+**  Read a byte of the caller's buffer, from RAM or flash
 */
 
-void fdserial_send(unsigned char send_arg) {
-	// Wait until previous byte finished
-	while (! fd_uart1.send_ready) { }
-
-	OCR1A = TCNT1;
-	fd_uart1.send_ready = 0;
-	fd_uart1.send_byte = send_arg;
-	fd_uart1.tx_state = 1; // Send start bit
-	_start_tx();
+static inline unsigned char _tx_read(const uint8_t *p) {
+	return fd_uart1.tx_pgm ? pgm_read_byte(p) : *p;
 }
+#endif
 
+#ifdef FRAMING
 /*
-**  c = fdserial_recv()
-**    Return the received character.
-**    The receive interface is buffered, so when a character is available
-**    the MCU has at most 1 character-time to receive it, otherwise it
-**    will be overwritten by the next character.
-**
-**    This function will wait until a character is received.
+**  Read a byte of the frame being sent. With RUNNING_CRC the CRC
+**  follows the caller's data, and the data is added to the CRC.
 */
 
-unsigned char fdserial_recv() {
-	unsigned char c;
-
-#ifdef RING_BUFFER
-	// Wait until chars in buffer
-	while (fd_uart1.rx_head == fd_uart1.rx_tail) { }
+static inline unsigned char _frame_read(const uint8_t *p) {
+#ifdef RUNNING_CRC
+	const uint8_t *end = fd_uart1.tx_end;
 
-	c = fd_uart1.rx_buf[fd_uart1.rx_tail];
+	if (p < end) {
+		unsigned char c = _tx_read(p);
+		fd_uart1.crc_tx = _crc_update(fd_uart1.crc_tx, c);
+		return c;
+	}
 
-	// Don't use the 'mod' operation because it is expensive.
-	// Also don't ever set rx_tail = RING_BUFFER.
-	if (fd_uart1.rx_tail == RING_BUFFER - 1) {
-		fd_uart1.rx_tail = 0;
-	} else {
-		fd_uart1.rx_tail ++;
+#if RUNNING_CRC == 16
+	if (p == end) {
+		return fd_uart1.crc_tx >> 8;
 	}
+#endif
+	return fd_uart1.crc_tx & 0xff;
 #else
-	// Wait until available
-	while (! fd_uart1.available) { }
-	c = fd_uart1.recv_byte;
-	fd_uart1.recv_byte = 0;  // Reading nulls means you are probably doing something wrong
-	fd_uart1.available = 0;
+	return _tx_read(p);
 #endif
-
-	return c;
 }
 
+/*
+**  The closing delimiter has been loaded.
+*/
+
+static inline void _tx_frame_done(void) {
+	fd_uart1.tx_frame = 0;
+	if (fd_uart1.tx_done) {
+		fd_uart1.tx_done();
+	}
+}
+#endif
 
+#ifdef FRAMING_COBS
 /*
-**  fdserial_alarm(uint32_t duration)
-**
-**  Keep the transmit system busy for the specified number of ms.
-**
-**  Wait until the transmit state is idle, then setup the
-**  transmit bit comparator to count down.
+**  Look one byte further ahead for the end of the next COBS block.
+**  Called once per tx bit time, so it keeps ahead of the encoder
+**  unless a short block is followed by a long one. The encoder
+**  waits for it in that case.
 */
 
-void fdserial_alarm(uint32_t duration) {
-	uint32_t timer_ticks = ( duration * CPU_FREQ ) / PRESCALER_DIVISOR / 1000;
-	uint32_t cycles = timer_ticks / ( SERIAL_TOP + 1);
-	uint8_t remainder = timer_ticks - (cycles * (SERIAL_TOP + 1));
-	// Wait until available
-	while (! fd_uart1.send_ready) { }
+static inline void _cobs_scan(void) {
+	if (fd_uart1.next_code || ! fd_uart1.scan_more) {
+		return;
+	}
 
-	OCR1A = TCNT1 - remainder;
-	fd_uart1.delay = cycles;
-	fd_uart1.send_ready = 0;
-	fd_uart1.tx_state = 5;
+	const uint8_t *p = fd_uart1.scan_ptr;
+
+	if (p == fd_uart1.scan_end) {
+		// Last block ends with the buffer
+		fd_uart1.next_code = fd_uart1.scan_run + 1;
+		fd_uart1.next_zero = 0;
+		fd_uart1.scan_more = 0;
+		return;
+	}
+
+	fd_uart1.scan_ptr = p + 1;
+
+	if (! _frame_read(p)) {
+		// Block ends at a zero, and another always follows
+		fd_uart1.next_code = fd_uart1.scan_run + 1;
+		fd_uart1.next_zero = 1;
+		fd_uart1.scan_run = 0;
+		return;
+	}
+
+	if (++fd_uart1.scan_run == 254) {
+		// Longest block, with no zero after it
+		fd_uart1.next_code = 0xff;
+		fd_uart1.next_zero = 0;
+		fd_uart1.scan_run = 0;
+		fd_uart1.scan_more = (p + 1 != fd_uart1.scan_end);
+	}
 }
 
 /*
-**  fdserial_delay(uint32_t duration)
-**
-**  Delay for the specified number of ms.
-**
-**  Setup an alarm for the specified duration, then
-**  spin until the alarm has expired (transmit state
-**  has returned to idle).
+**  Load the next COBS encoded byte into send_shift.
+**  Return 0 if the scanner has not found the next block yet.
 */
 
-void fdserial_delay(uint32_t duration) {
-	fdserial_alarm(duration);
+static inline uint8_t _tx_frame_next(void) {
+	if (fd_uart1.tx_enc) {
+		const uint8_t *p = fd_uart1.tx_ptr;
 
-	// Wait until alarm expires
-	while (! fd_uart1.send_ready) { }
+		// The scanner has already added this byte to the CRC
+#ifdef RUNNING_CRC
+		if (p >= fd_uart1.tx_end) {
+			fd_uart1.send_shift = _frame_read(p);
+		} else
+#endif
+		fd_uart1.send_shift = _tx_read(p);
+		fd_uart1.tx_ptr = p + 1;
+		if (! --fd_uart1.tx_enc && fd_uart1.tx_zero) {
+			// Skip the zero which ends the block
+			fd_uart1.tx_ptr = p + 2;
+		}
+		return 1;
+	}
+
+	if (fd_uart1.next_code) {
+		uint8_t code = fd_uart1.next_code;
+
+		fd_uart1.send_shift = code;
+		fd_uart1.next_code = 0;
+		fd_uart1.tx_enc = code - 1;
+		fd_uart1.tx_zero = fd_uart1.next_zero;
+		if (code == 1 && fd_uart1.tx_zero) {
+			fd_uart1.tx_ptr ++;
+		}
+		return 1;
+	}
+
+	if (fd_uart1.scan_more) {
+		return 0;
+	}
+
+	fd_uart1.send_shift = 0;
+	_tx_frame_done();
+	return 1;
 }
+#endif
 
+#ifdef FRAMING_SLIP
 /*
-** Interrupt handler for timer1, TCCR1A, tx bits
+**  Load the next SLIP encoded byte into send_shift.
 */
 
-ISR(TIMER1_COMPA_vect)
-{
-	switch(fd_uart1.tx_state) {
-		case 0: // Idle
-			return;
+static inline uint8_t _tx_frame_next(void) {
+	unsigned char c;
 
-		case 1: // Send start bit
-			PORTB &= ~( S1_TX_PIN );
-			fd_uart1.tx_state = 2;
-			fd_uart1.send_bits = 8;
-			return;
+	if (fd_uart1.tx_enc) {
+		fd_uart1.send_shift = fd_uart1.tx_enc;
+		fd_uart1.tx_enc = 0;
+		return 1;
+	}
 
-		case 2: // Send a bit
-			if (fd_uart1.send_byte & 1) {
-				PORTB |= S1_TX_PIN;
-			} else {
-				PORTB &= ~( S1_TX_PIN );
-			}
-			fd_uart1.send_byte >>= 1;
+	if (fd_uart1.tx_len) {
+		const uint8_t *p = fd_uart1.tx_ptr;
 
-			if (! --fd_uart1.send_bits) {
-				fd_uart1.tx_state = 3;
-			}
-			return;
+		c = _frame_read(p);
+		fd_uart1.tx_ptr = p + 1;
+		fd_uart1.tx_len --;
 
-		case 3: // Send stop bit
-			PORTB |= S1_TX_PIN;
-			fd_uart1.tx_state = 4;
-			return;
+		if (c == SLIP_END) {
+			c = SLIP_ESC;
+			fd_uart1.tx_enc = SLIP_ESC_END;
+		} else if (c == SLIP_ESC) {
+			fd_uart1.tx_enc = SLIP_ESC_ESC;
+		}
 
-		case 4: // Return to idle mode
-			fd_uart1.send_ready = 1;
-			fd_uart1.tx_state = 0;
-			_stop_tx();
-			return;
-		case 5: // Timed delay
-			if (! --fd_uart1.delay) {
-				fd_uart1.send_ready = 1;
-				fd_uart1.tx_state = 0;
-			}
-			return;
+		fd_uart1.send_shift = c;
+		return 1;
 	}
+
+	fd_uart1.send_shift = SLIP_END;
+	_tx_frame_done();
+	return 1;
 }
+#endif
 
 /*
-** Interrupt handler for timer1, TCCR1B, rx bits
+**  Load the next byte to send into send_shift, if there is one.
+**  XON/XOFF go first and are sent even while paused.
 */
 
-ISR(TIMER1_COMPB_vect)
-{
-	// Read the bit as early as possible, to try to hit the
-	// center mark
-	uint8_t read_bit = PINB & S1_RX_PIN;
-
-	switch(fd_uart1.rx_state) {
-		case 0: // Midpoint of start bit. Go on to first data bit.
-			fd_uart1.rx_state = 2;
-			fd_uart1.recv_bits = 8;
-			break;
+static inline uint8_t _tx_next(void) {
+#ifdef MULTIDROP
+	fd_uart1.send_nine = 0;
+#endif
+#ifdef XON_XOFF
+	if (fd_uart1.tx_ctrl) {
+		fd_uart1.send_shift = fd_uart1.tx_ctrl;
+		fd_uart1.tx_ctrl = 0;
+		return 1;
+	}
+#endif
+#ifdef TX_FLOW_CONTROL
+	if (_tx_paused()) {
+		return 0;
+	}
+#endif
+#ifdef RX_BRIDGE
+	if (fd_uart1.bridge_full) {
+		fd_uart1.send_shift = fd_uart1.bridge_byte;
+		fd_uart1.bridge_full = 0;
+		return 1;
+	}
+#endif
+#ifdef FRAMING
+	if (fd_uart1.tx_frame) {
+		if (fd_uart1.tx_frame == 1) {
+			// Opening delimiter
+#ifdef FRAMING_SLIP
+			fd_uart1.send_shift = SLIP_END;
+#else
+			fd_uart1.send_shift = 0;
+#endif
+			fd_uart1.tx_frame = 2;
+			return 1;
+		}
 
-		case 1: // Reading start bit
-			// Go straight on to first data bit
-			fd_uart1.rx_state = 2;
-			fd_uart1.recv_bits = 8;
-			break;
+		return _tx_frame_next();
+	}
+#endif
+#ifdef SEND_BUFFER
+	if (fd_uart1.tx_len) {
+		const uint8_t *p = fd_uart1.tx_ptr;
+
+		fd_uart1.send_shift = _tx_read(p);
+		fd_uart1.tx_ptr = p + 1;
+#ifdef RUNNING_CRC
+		fd_uart1.crc_tx = _crc_update(fd_uart1.crc_tx, fd_uart1.send_shift);
+#endif
 
-		case 2: // Reading a data bit
-			fd_uart1.recv_shift >>= 1;
-			if (read_bit) {
-				fd_uart1.recv_shift |= 0x80;
-			}
+		if (! --fd_uart1.tx_len && fd_uart1.tx_done) {
+			fd_uart1.tx_done();
+		}
+		return 1;
+	}
+#endif
+	if (! SEND_READY) {
+		fd_uart1.send_shift = fd_uart1.send_byte;
+#ifdef MULTIDROP
+		fd_uart1.send_nine = fd_uart1.send_addr;
+#endif
+		SET_SEND_READY();
+#ifdef FD_TASK
+		fd_task_wake |= FD_WAKE_TX;
+#endif
+#ifdef RUNNING_CRC
+		fd_uart1.crc_tx = _crc_update(fd_uart1.crc_tx, fd_uart1.send_shift);
+#endif
+		return 1;
+	}
 
-			if (! --fd_uart1.recv_bits) {
-				fd_uart1.rx_state = 3;
-			}
-			break;
+	return 0;
+}
 
-		case 3: // Byte done, wait for high
-			if (read_bit) {
-#ifdef RING_BUFFER
-				// Put the latest char in the buffer
-				fd_uart1.rx_buf[fd_uart1.rx_head] = fd_uart1.recv_shift;
-
-				// Increment the buffer head
-				if (fd_uart1.rx_head == RING_BUFFER - 1) {
-					fd_uart1.rx_head = 0;
-				} else {
-					fd_uart1.rx_head ++;
-				}
+/*
+**  True if there is something to send which _tx_next() could not
+**  load yet, so the transmitter must not go idle.
+*/
 
-				// If buffer is full,
-				if (fd_uart1.rx_head == fd_uart1.rx_tail) {
-					// Increment rx_tail to drop oldest character
-					if (fd_uart1.rx_tail == RING_BUFFER - 1) {
-						fd_uart1.rx_tail = 0;
-					} else {
-						fd_uart1.rx_tail ++;
-					}
-				}
-#else
-				fd_uart1.recv_byte = fd_uart1.recv_shift;
-				fd_uart1.available = 1;
+static inline uint8_t _tx_waiting(void) {
+	if (! SEND_READY) {
+		return 1;
+	}
+#ifdef RX_BRIDGE
+	if (fd_uart1.bridge_full) {
+		return 1;
+	}
 #endif
-				fd_uart1.rx_state = 0;
-				_stop_rx();
-				_enable_int0();
-			}
-			break;
+#ifdef SEND_BUFFER
+	if (fd_uart1.tx_len) {
+		return 1;
+	}
+#endif
+#ifdef FRAMING
+	if (fd_uart1.tx_frame) {
+		return 1;
 	}
+#endif
+	return 0;
 }
 
+#ifdef RX_FLOW_CONTROL
+#ifdef XON_XOFF
 /*
-** This is called on the falling edge of INT0 (pin 7).
-** It is the beginning of a start bit.
+**  Queue XON or XOFF ahead of any waiting byte.
+**  Call with interrupts disabled.
 */
 
-ISR(INT0_vect) {
-	uint8_t tcnt1 = TCNT1;
-
-	// Set sample time, half a bit after now.
-	if (tcnt1 >= SERIAL_HALFBIT) {
-		OCR1B = tcnt1 - SERIAL_HALFBIT;
-	} else {
-		OCR1B = tcnt1 + SERIAL_HALFBIT;
+static void _send_ctrl(unsigned char c) {
+	fd_uart1.tx_ctrl = c;
+	if (! TX_STATE) {
+		_tx_wakeup();
 	}
-
+}
+#endif
+
+/*
+**  Ask the sender to stop, at the high water mark.
+*/
+
+static inline void _rx_throttle(void) {
+	fd_uart1.rx_throttled = 1;
+#ifdef FLOW_RTS_PIN
+	PORTB |= FLOW_RTS_PIN;
+#endif
+#ifdef XON_XOFF
+	_send_ctrl(XOFF);
+#endif
+}
+
+/*
+**  Let the sender continue, at the low water mark.
+**  Call with interrupts disabled.
+*/
+
+static inline void _rx_release(void) {
+	fd_uart1.rx_throttled = 0;
+#ifdef FLOW_RTS_PIN
+	PORTB &= ~( FLOW_RTS_PIN );
+#endif
+#ifdef XON_XOFF
+	_send_ctrl(XON);
+#endif
+}
+#endif
+
+/*
+**  Initialise the software UART.
+**
+**  Configure timer1 as follows:
+**    1 interrupts per data bit
+**    CTC mode (CTC1=1)
+**    No output pin
+**    Frequency = CPU_FREQ / PRESCALER_DIVISOR / (SERIAL_TOP + 1),
+**    e.g. 8000000 / 4 / 208 = 9615 bits/sec for 9600
+**  Configure INT0 so an interrupt occurs on the falling edge
+**    of INT0 (pin 7)
+*/
+
+void fdserial_init(void) {
+	uint8_t com_mode = 0<<COM1A1 | 0<<COM1A0;
+	uint8_t ctc_mode = 1<<CTC1;
+
+	SET_SEND_READY();
+	TX_STATE = 0;
+#if FD_PARITY
+	fd_uart1.parity_errors = 0;
+#endif
+#ifdef LIN_SLAVE
+	fd_uart1.lin_phase = LIN_IDLE;
+	fd_uart1.lin_half = SERIAL_HALFBIT;
+	fd_uart1.lin_ready = 0;
+	fd_uart1.lin_errors = 0;
+#endif
+#ifdef MULTIDROP
+	fd_uart1.rx_filter = 0;
+	fd_uart1.rx_selected = 1;
+#endif
+
+#ifndef RING_BUFFER
+	CLEAR_AVAILABLE();
+#endif
+	RX_STATE = 0;
+
+#ifdef RING_BUFFER
+	fd_uart1.rx_head = 0;
+	fd_uart1.rx_tail = 0;
+#endif
+
+#ifdef RX_FLOW_CONTROL
+	fd_uart1.rx_throttled = 0;
+#endif
+#ifdef XON_XOFF
+	fd_uart1.tx_paused = 0;
+	fd_uart1.tx_ctrl = 0;
+#endif
+#ifdef RX_NOTIFY
+	fd_uart1.rx_events = 0;
+#ifdef RX_CALLBACK
+	fd_uart1.rx_callback = 0;
+#endif
+#endif
+#ifdef RX_WATERMARK
+	fd_uart1.rx_marked = 0;
+#endif
+#ifdef RX_DELIMITER
+	fd_uart1.line_count = 0;
+	fd_uart1.line_length = 0;
+#endif
+#ifdef RX_BRIDGE
+	fd_uart1.bridge_mode = FD_BRIDGE_OFF;
+	fd_uart1.bridge_full = 0;
+#endif
+#ifdef SEND_BUFFER
+	fd_uart1.tx_len = 0;
+#endif
+#ifdef FRAMING
+	fd_uart1.frame_head = 0;
+	fd_uart1.frame_tail = 0;
+	fd_uart1.frame_start = 0;
+	fd_uart1.frame_len = 0;
+	fd_uart1.frame_bad = 0;
+	fd_uart1.rx_dec = 0;
+	fd_uart1.rx_code = 0xff;
+	fd_uart1.tx_frame = 0;
+	fd_uart1.tx_enc = 0;
+#endif
+#ifdef RUNNING_CRC
+	fd_uart1.crc_rx = CRC_INIT;
+	fd_uart1.crc_tx = CRC_INIT;
+#endif
+#ifdef RX_GAP_DETECT
+	// Start as if the line had been idle for a long time
+	fd_uart1.rx_gap = 255;
+#endif
+#ifdef RX_TIMESTAMP
+	fd_uart1.rx_clock = 0;
+#endif
+#ifdef RX_BLOCK
+	fd_uart1.blk_size = 0;
+	fd_uart1.blk_full = 0;
+	fd_uart1.blk_lost = 0;
+#endif
+
+	// Configure INT0 to interrupt on falling edge
+	MCUCR |= 1<<ISC01;
+
+	TCNT1 = 0;
+	OCR1A = 16; // this will be used for send bit timing
+	OCR1B = 32; // this will be used for receive bit timing
+	OCR1C = SERIAL_TOP;
+
+	// Configure pin PORTB3 as an output, and raise it
+	DDRB |= S1_TX_PIN;
+	PORTB |= S1_TX_PIN;
+
+	// Configure pin PORTB2 as an input, and enable pullup
+	DDRB &= ~( S1_RX_PIN );
+	PORTB |= S1_RX_PIN;
+
+#ifdef FLOW_RTS_PIN
+	// RTS is an output, low to let the sender go
+	DDRB |= FLOW_RTS_PIN;
+	PORTB &= ~( FLOW_RTS_PIN );
+#endif
+#ifdef FLOW_CTS_PIN
+	DDRB &= ~( FLOW_CTS_PIN );
+#endif
+#ifdef RS485_DE_PIN
+	// Driver off, listen to the bus
+	DDRB |= RS485_DE_PIN;
+	PORTB &= ~( RS485_DE_PIN );
+#endif
+
+	_stoptimer();
+	TCCR1 = ctc_mode | com_mode;
+	_starttimer();
+	_enable_int0();
+
+#ifdef RX_TIMESTAMP
+	// The rx bit timer is the clock, so it never stops
+	RX_STATE = 4;
+	_start_rx();
+#endif
+}
+
+/*
+**  fdserial_available()
+**    Return true if a character has been received on the receive interface.
+*/
+
+uint8_t fdserial_available(void) {
+#ifdef RING_BUFFER
+	return _rx_count();
+#else
+	return AVAILABLE;
+#endif
+}
+
+/*
+**  fdserial_sendok()
+**    Return true if fdserial_send() would not have to wait.
+*/
+
+uint8_t fdserial_sendok(void) {
+	return SEND_READY;
+}
+
+/*
+**  fdserial_send(c)
+**    Send the character c.
+*/
+
+void fdserial_send(unsigned char send_arg) {
+	// Wait until previous byte has started
+	while (! fdserial_trysend(send_arg)) { _poll_wait(); }
+}
+
+/*
+**  fdserial_trysend(c)
+**    Send the character c if the previous one has started,
+**    and return 1. Otherwise return 0 without waiting.
+*/
+
+uint8_t fdserial_trysend(unsigned char send_arg) {
+	uint8_t sreg = SREG;
+	cli();
+
+	if (! SEND_READY) {
+		SREG = sreg;
+		return 0;
+	}
+
+	fd_uart1.send_byte = send_arg;
+#ifdef MULTIDROP
+	fd_uart1.send_addr = 0;
+#endif
+	CLEAR_SEND_READY();
+	if (! TX_STATE) {
+		_tx_wakeup(); // Send start bit
+	}
+
+	SREG = sreg;
+	return 1;
+}
+
+#if FD_PARITY
+/*
+**  fdserial_parity_errors()
+**    Return and clear the parity error count.
+*/
+
+uint8_t fdserial_parity_errors(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t n = fd_uart1.parity_errors;
+	fd_uart1.parity_errors = 0;
+	SREG = sreg;
+
+	return n;
+}
+#endif
+
+#ifdef LIN_SLAVE
+/*
+**  fdserial_lin_subscribe(id, on)
+**    Start or stop receiving frames with this ID.
+*/
+
+void fdserial_lin_subscribe(uint8_t id, uint8_t on) {
+	uint8_t mask = 1 << (id & 7);
+	volatile uint8_t *p = &fd_uart1.lin_filter[(id >> 3) & 7];
+
+	uint8_t sreg = SREG;
+	cli();
+	if (on) {
+		*p |= mask;
+	} else {
+		*p &= ~mask;
+	}
+	SREG = sreg;
+}
+
+/*
+**  fdserial_lin_recv(id, buf)
+**    Take the last frame received, if there is one.
+*/
+
+uint8_t fdserial_lin_recv(uint8_t *id, uint8_t *buf) {
+	uint8_t len;
+
+	if (! fd_uart1.lin_ready) {
+		return 0;
+	}
+
+	// No new frame is stored until lin_ready is cleared
+	len = fd_uart1.lin_len;
+	*id = fd_uart1.lin_pid & 0x3f;
+	for (uint8_t i = 0; i < len; ++i) {
+		buf[i] = fd_uart1.lin_buf[i];
+	}
+	fd_uart1.lin_ready = 0;
+
+	return len;
+}
+
+/*
+**  fdserial_lin_errors()
+**    Return and clear the error count.
+*/
+
+uint8_t fdserial_lin_errors(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t n = fd_uart1.lin_errors;
+	fd_uart1.lin_errors = 0;
+	SREG = sreg;
+
+	return n;
+}
+#endif
+
+#ifdef MULTIDROP
+/*
+**  fdserial_send_address(addr)
+**    Send addr with the 9th bit set.
+*/
+
+void fdserial_send_address(uint8_t addr) {
+	uint8_t sreg;
+
+	// Wait until the previous byte has started
+	while (1) {
+		sreg = SREG;
+		cli();
+		if (SEND_READY) {
+			break;
+		}
+		SREG = sreg;
+		_poll_wait();
+	}
+
+	fd_uart1.send_byte = addr;
+	fd_uart1.send_addr = 1;
+	CLEAR_SEND_READY();
+	if (! TX_STATE) {
+		_tx_wakeup();
+	}
+
+	SREG = sreg;
+}
+
+/*
+**  fdserial_set_address(addr)
+**    Drop data until an address byte for addr is received.
+*/
+
+void fdserial_set_address(uint8_t addr) {
+	uint8_t sreg = SREG;
+	cli();
+	fd_uart1.rx_address = addr;
+	fd_uart1.rx_filter = 1;
+	fd_uart1.rx_selected = 0;
+	SREG = sreg;
+}
+
+/*
+**  fdserial_clear_address()
+**    Receive all data bytes.
+*/
+
+void fdserial_clear_address(void) {
+	uint8_t sreg = SREG;
+	cli();
+	fd_uart1.rx_filter = 0;
+	fd_uart1.rx_selected = 1;
+	SREG = sreg;
+}
+#endif
+
+#ifdef SEND_BUFFER
+/*
+**  Hand a buffer to the tx ISR. Bytes already passed to
+**  fdserial_send() go first; later ones wait for the buffer.
+*/
+
+static void _send_buffer(const void *buf, uint16_t len, uint8_t pgm, fdserial_done_t done) {
+	if (! len) {
+		if (done) {
+			done();
+		}
+		return;
+	}
+
+	// Wait until the previous buffer and byte have started
+	while (fdserial_buffer_busy() || ! SEND_READY) { _poll_wait(); }
+
+	uint8_t sreg = SREG;
+	cli();
+	fd_uart1.tx_ptr = buf;
+	fd_uart1.tx_pgm = pgm;
+	fd_uart1.tx_done = done;
+	fd_uart1.tx_len = len;
+	if (! TX_STATE) {
+		_tx_wakeup();
+	}
+	SREG = sreg;
+}
+
+/*
+**  fdserial_send_buffer(buf, len, done)
+**    Send len bytes from buf, which must not change until done
+**    is called (or fdserial_buffer_busy() returns false).
+*/
+
+void fdserial_send_buffer(const void *buf, uint16_t len, fdserial_done_t done) {
+	_send_buffer(buf, len, 0, done);
+}
+
+/*
+**  fdserial_send_buffer_P(buf_P, len, done)
+**    Send len bytes from flash.
+*/
+
+void fdserial_send_buffer_P(const void *buf_P, uint16_t len, fdserial_done_t done) {
+	_send_buffer(buf_P, len, 1, done);
+}
+
+/*
+**  fdserial_buffer_busy()
+**    Return true until the last byte of the buffer has been taken.
+*/
+
+uint8_t fdserial_buffer_busy(void) {
+	// tx_len is two bytes, changed by the ISR
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t busy = fd_uart1.tx_len != 0;
+#ifdef FRAMING
+	busy |= fd_uart1.tx_frame;
+#endif
+	SREG = sreg;
+
+	return busy;
+}
+
+#ifdef FRAMING
+/*
+**  Hand a frame to the tx ISR for encoding.
+*/
+
+static void _send_frame(const void *buf, uint16_t len, uint8_t pgm, fdserial_done_t done) {
+	// Wait until the previous buffer and byte have started
+	while (fdserial_buffer_busy() || ! SEND_READY) { _poll_wait(); }
+
+	fd_uart1.tx_ptr = buf;
+	fd_uart1.tx_pgm = pgm;
+	fd_uart1.tx_done = done;
+	fd_uart1.tx_enc = 0;
+#ifdef RUNNING_CRC
+	fd_uart1.tx_end = (const uint8_t *) buf + len;
+	fd_uart1.crc_tx = CRC_INIT;
+#endif
+#ifdef FRAMING_COBS
+	fd_uart1.scan_ptr = buf;
+	fd_uart1.scan_end = (const uint8_t *) buf + len + CRC_BYTES;
+	fd_uart1.scan_run = 0;
+	fd_uart1.scan_more = 1;
+	fd_uart1.next_code = 0;
+
+	// Find the first block here rather than stall the ISR
+	while (! fd_uart1.next_code) {
+		_cobs_scan();
+	}
+#endif
+
+	// tx_len and tx_frame together: with only tx_len set, the ISR
+	// would send the frame as a plain buffer
+	uint8_t sreg = SREG;
+	cli();
+#ifdef FRAMING_SLIP
+	fd_uart1.tx_len = len + CRC_BYTES;
+#endif
+	fd_uart1.tx_frame = 1;
+	if (! TX_STATE) {
+		_tx_wakeup();
+	}
+	SREG = sreg;
+}
+
+/*
+**  fdserial_send_frame(buf, len, done)
+**    Send len bytes from buf as one frame. buf must not change
+**    until done is called (or fdserial_buffer_busy() returns false).
+*/
+
+void fdserial_send_frame(const void *buf, uint16_t len, fdserial_done_t done) {
+	_send_frame(buf, len, 0, done);
+}
+
+/*
+**  fdserial_send_frame_P(buf_P, len, done)
+**    Send len bytes from flash as one frame.
+*/
+
+void fdserial_send_frame_P(const void *buf_P, uint16_t len, fdserial_done_t done) {
+	_send_frame(buf_P, len, 1, done);
+}
+
+/*
+**  fdserial_frame_available()
+**    Return the length of the next complete frame, or 0.
+*/
+
+uint8_t fdserial_frame_available(void) {
+	if (fd_uart1.frame_head == fd_uart1.frame_tail) {
+		return 0;
+	}
+
+	return fd_uart1.frame_q[fd_uart1.frame_tail];
+}
+
+#ifdef RUNNING_CRC
+/*
+**  fdserial_frame_crc()
+**    Return the CRC of the next complete frame, including the CRC
+**    bytes at its end. 0 means the frame is good.
+*/
+
+fdserial_crc_t fdserial_frame_crc(void) {
+	return fd_uart1.frame_crc[fd_uart1.frame_tail];
+}
+#endif
+
+/*
+**  len = fdserial_recv_frame(buf, size)
+**    Copy the next frame into buf, waiting until there is one.
+**    Return the frame length; bytes beyond size are discarded.
+*/
+
+uint8_t fdserial_recv_frame(unsigned char *buf, uint8_t size) {
+	uint8_t len;
+	uint8_t i;
+
+	while (! (len = fdserial_frame_available())) { _poll_wait(); }
+
+	for (i = 0; i < len; ++i) {
+		unsigned char c = fdserial_recv();
+		if (i < size) {
+			buf[i] = c;
+		}
+	}
+
+	if (fd_uart1.frame_tail == RX_FRAMES - 1) {
+		fd_uart1.frame_tail = 0;
+	} else {
+		fd_uart1.frame_tail ++;
+	}
+
+	return len;
+}
+#endif
+#endif
+
+/*
+**  c = fdserial_recv()
+**    Return the received character.
+**    The receive interface is buffered, so when a character is available
+**    the MCU has at most 1 character-time to receive it, otherwise it
+**    will be overwritten by the next character.
+**
+**    This function will wait until a character is received.
+*/
+
+unsigned char fdserial_recv() {
+	unsigned char c;
+
+#ifdef RING_BUFFER
+	// Wait until chars in buffer
+	while (fd_uart1.rx_head == fd_uart1.rx_tail) { _poll_wait(); }
+
+	c = fd_uart1.rx_buf[fd_uart1.rx_tail];
+
+	// Don't use the 'mod' operation because it is expensive.
+	// Also don't ever set rx_tail = RING_BUFFER.
+	if (fd_uart1.rx_tail == RING_BUFFER - 1) {
+		fd_uart1.rx_tail = 0;
+	} else {
+		fd_uart1.rx_tail ++;
+	}
+
+#ifdef RX_FLOW_CONTROL
+	if (fd_uart1.rx_throttled && _rx_count() <= RX_LOW_WATER) {
+		uint8_t sreg = SREG;
+		cli();
+		_rx_release();
+		SREG = sreg;
+	}
+#endif
+#ifdef RX_WATERMARK
+	// Re-arm the watermark event
+	if (fd_uart1.rx_marked && _rx_count() < RX_WATERMARK) {
+		fd_uart1.rx_marked = 0;
+	}
+#endif
+#else
+	// Wait until available
+	while (! AVAILABLE) { _poll_wait(); }
+	c = fd_uart1.recv_byte;
+	fd_uart1.recv_byte = 0;  // Reading nulls means you are probably doing something wrong
+	CLEAR_AVAILABLE();
+#endif
+
+	return c;
+}
+
+#ifdef RX_NOTIFY
+/*
+**  fdserial_events()
+**    Return the FD_EVENT_* bits raised by the receiver since the
+**    last call, and clear them.
+*/
+
+uint8_t fdserial_events(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t events = fd_uart1.rx_events;
+	fd_uart1.rx_events = 0;
+	SREG = sreg;
+
+	return events;
+}
+#endif
+
+#ifdef RX_TIMESTAMP
+/*
+**  fdserial_clock()
+**    Return the count of bit times, which wraps at 65536.
+*/
+
+uint16_t fdserial_clock(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t t = fd_uart1.rx_clock;
+	SREG = sreg;
+
+	return t;
+}
+
+/*
+**  fdserial_timestamp()
+**    Return the clock at the stop bit of the next byte to be read.
+**    Only meaningful while fdserial_available() is non-zero.
+*/
+
+uint16_t fdserial_timestamp(void) {
+	return fd_uart1.rx_stamp[fd_uart1.rx_tail];
+}
+#endif
+
+#ifdef RX_DELIMITER
+/*
+**  fdserial_line_length()
+**    Return the length of the most recent complete line, including
+**    the delimiter. Valid after FD_EVENT_LINE.
+*/
+
+uint8_t fdserial_line_length(void) {
+	return fd_uart1.line_length;
+}
+#endif
+
+#ifdef RX_BLOCK
+/*
+**  fdserial_recv_blocks(a, b, size)
+**    Have the rx ISR fill a, then b, then a again, and so on.
+**    Any partly filled block is abandoned.
+*/
+
+void fdserial_recv_blocks(uint8_t *a, uint8_t *b, uint8_t size) {
+	uint8_t sreg = SREG;
+	cli();
+	fd_uart1.blk_base[0] = a;
+	fd_uart1.blk_base[1] = b;
+	fd_uart1.blk_ptr = a;
+	fd_uart1.blk_end = a + size;
+	fd_uart1.blk_fill = 0;
+	fd_uart1.blk_full = 0;
+	fd_uart1.blk_size = size;
+	SREG = sreg;
+}
+
+/*
+**  fdserial_block_ready()
+**    Return the oldest full block, or 0. The one after it is
+**    always the other block.
+*/
+
+uint8_t *fdserial_block_ready(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t *p = fd_uart1.blk_full ? fd_uart1.blk_base[fd_uart1.blk_fill ^ 1] : 0;
+	SREG = sreg;
+
+	return p;
+}
+
+/*
+**  fdserial_block_done()
+**    Finish with the oldest full block. If the ISR had stopped with
+**    both blocks full, it starts filling this one.
+*/
+
+void fdserial_block_done(void) {
+	uint8_t sreg = SREG;
+	cli();
+	if (fd_uart1.blk_full) {
+		if (! fd_uart1.blk_ptr) {
+			uint8_t f = fd_uart1.blk_fill ^ 1;
+
+			fd_uart1.blk_fill = f;
+			fd_uart1.blk_ptr = fd_uart1.blk_base[f];
+			fd_uart1.blk_end = fd_uart1.blk_base[f] + fd_uart1.blk_size;
+		}
+		fd_uart1.blk_full --;
+	}
+	SREG = sreg;
+}
+
+/*
+**  fdserial_block_overruns()
+**    Return and clear the count of bytes dropped, up to 255.
+*/
+
+uint8_t fdserial_block_overruns(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t n = fd_uart1.blk_lost;
+	fd_uart1.blk_lost = 0;
+	SREG = sreg;
+
+	return n;
+}
+#endif
+
+#ifdef RUNNING_CRC
+/*
+**  fdserial_crc_reset(dir)
+**    Restart the CRC for FD_RX and/or FD_TX.
+*/
+
+void fdserial_crc_reset(uint8_t dir) {
+	uint8_t sreg = SREG;
+	cli();
+	if (dir & FD_RX) {
+		fd_uart1.crc_rx = CRC_INIT;
+	}
+	if (dir & FD_TX) {
+		fd_uart1.crc_tx = CRC_INIT;
+	}
+	SREG = sreg;
+}
+
+/*
+**  fdserial_crc(dir)
+**    Return the CRC of the bytes received (FD_RX) or sent (FD_TX)
+**    since the last reset.
+*/
+
+fdserial_crc_t fdserial_crc(uint8_t dir) {
+	uint8_t sreg = SREG;
+	cli();
+	fdserial_crc_t crc = dir == FD_RX ? fd_uart1.crc_rx : fd_uart1.crc_tx;
+	SREG = sreg;
+
+	return crc;
+}
+#endif
+
+#ifdef RX_BRIDGE
+/*
+**  fdserial_bridge(mode, filter_P, map_P)
+**    Forward received bytes to the transmitter from the rx ISR.
+**    filter_P and map_P point to PROGMEM, or are 0 for none.
+*/
+
+void fdserial_bridge(uint8_t mode, const uint8_t *filter_P, const uint8_t *map_P) {
+	uint8_t sreg = SREG;
+	cli();
+	fd_uart1.bridge_filter = filter_P;
+	fd_uart1.bridge_map = map_P;
+	fd_uart1.bridge_mode = mode;
+	SREG = sreg;
+}
+#endif
+
+#ifdef RX_CALLBACK
+/*
+**  fdserial_set_callback(callback)
+**    The callback runs in interrupt context, so it must be short.
+*/
+
+void fdserial_set_callback(void (*callback)(uint8_t events)) {
+	fd_uart1.rx_callback = callback;
+}
+#endif
+
+/*
+**  fdserial_alarm(uint32_t duration)
+**
+**  Keep the transmit system busy for the specified number of ms.
+**
+**  Wait until the transmit state is idle, then setup the
+**  transmit bit comparator to count down.
+*/
+
+void fdserial_alarm(uint32_t duration) {
+	uint32_t timer_ticks = ( duration * CPU_FREQ ) / PRESCALER_DIVISOR / 1000;
+	uint32_t cycles = timer_ticks / ( SERIAL_TOP + 1);
+	uint8_t remainder = timer_ticks - (cycles * (SERIAL_TOP + 1));
+	// Wait until idle, checking with interrupts off so that nothing
+	// (an XON or XOFF from the rx ISR, say) is queued before the alarm
+	uint8_t sreg = SREG;
+	cli();
+	while (TX_STATE || ! SEND_READY) {
+		SREG = sreg;
+		_poll_wait();
+		cli();
+	}
+
+	OCR1A = TCNT1 - remainder;
+	fd_uart1.delay = cycles;
+	TX_STATE = 5;
+	_start_tx();
+	SREG = sreg;
+}
+
+/*
+**  fdserial_delay(uint32_t duration)
+**
+**  Delay for the specified number of ms.
+**
+**  Setup an alarm for the specified duration, then
+**  spin until the alarm has expired (transmit state
+**  has left the timed delay).
+*/
+
+void fdserial_delay(uint32_t duration) {
+	fdserial_alarm(duration);
+
+	// Wait until alarm expires
+	while (TX_STATE == 5) { _poll_wait(); }
+}
+
+/*
+**  fdserial_send_break(bit_times)
+**
+**  Wait until the transmitter is idle, then hold the line low
+**  for bit_times. A break should be longer than a whole frame.
+*/
+
+void fdserial_send_break(uint16_t bit_times) {
+	if (! bit_times) {
+		return;
+	}
+
+	// Wait until everything queued has been sent, checking with
+	// interrupts off so that nothing can be queued before the break
+	uint8_t sreg = SREG;
+	cli();
+	while (TX_STATE || ! SEND_READY) {
+		SREG = sreg;
+		_poll_wait();
+		cli();
+	}
+
+	OCR1A = TCNT1;
+	fd_uart1.delay = bit_times;
+	TX_STATE = 6;
+	_start_tx();
+	SREG = sreg;
+}
+
+/*
+** Interrupt handler for timer1, TCCR1A, tx bits
+*/
+
+FD_HANDLER(TIMER1_COMPA_vect, _tx_handler)
+{
+#ifdef FRAMING_COBS
+	if (fd_uart1.tx_frame) {
+		_cobs_scan();
+	}
+#endif
+
+	switch(TX_STATE) {
+		case 0: // Idle
+			return;
+
+		case 1: // Send start bit
+			if (! _tx_next()) {
+				if (! _tx_waiting()) {
+					_tx_idle();
+				}
+				// else paused: try again next bit time
+				return;
+			}
+#ifdef RS485_DE_PIN
+			// Take the bus just before the start bit
+			PORTB |= RS485_DE_PIN;
+#endif
+			PORTB &= ~( S1_TX_PIN );
+			TX_STATE = 2;
+			SET_SEND_BITS(FRAME_BITS);
+#if FD_PARITY
+			fd_uart1.send_par = PARITY_INIT;
+#endif
+			return;
+
+		case 2: // Send a bit
+			if (fd_uart1.send_shift & 1) {
+				PORTB |= S1_TX_PIN;
+#ifdef PARITY_XOR
+				fd_uart1.send_par ^= 1;
+#endif
+			} else {
+				PORTB &= ~( S1_TX_PIN );
+			}
+			fd_uart1.send_shift >>= 1;
+#ifdef MULTIDROP
+			if (SEND_BITS == 2) {
+				// 8 bits sent, the 9th is next
+				fd_uart1.send_shift = fd_uart1.send_nine;
+			}
+#elif FD_PARITY
+			if (SEND_BITS == 2) {
+				// Data sent, the parity bit is next
+				fd_uart1.send_shift = fd_uart1.send_par;
+			}
+#endif
+
+			if (! DEC_SEND_BITS()) {
+				TX_STATE = 3;
+			}
+			return;
+
+		case 3: // Send stop bit
+			PORTB |= S1_TX_PIN;
+#if FD_STOP_BITS == 2
+			TX_STATE = 7;
+#else
+			TX_STATE = 4;
+#endif
+			return;
+
+		case 4: // End of stop bit
+			if (_tx_next()) {
+				// Start bit of the next byte, with no idle bit between
+				PORTB &= ~( S1_TX_PIN );
+				TX_STATE = 2;
+				SET_SEND_BITS(FRAME_BITS);
+#if FD_PARITY
+				fd_uart1.send_par = PARITY_INIT;
+#endif
+			} else if (! _tx_waiting()) {
+				_tx_idle();
+			} else {
+				// Paused with a byte waiting
+#ifdef RS485_DE_PIN
+				PORTB &= ~( RS485_DE_PIN );
+#endif
+				TX_STATE = 1;
+			}
+			return;
+
+		case 5: // Timed delay
+			if (! --fd_uart1.delay) {
+				// Send anything queued during the delay
+				TX_STATE = 1;
+			}
+			return;
+
+		case 6: // Break
+#ifdef RS485_DE_PIN
+			PORTB |= RS485_DE_PIN;
+#endif
+			PORTB &= ~( S1_TX_PIN );
+			if (! --fd_uart1.delay) {
+				// Raise the line next time, like a stop bit
+				TX_STATE = 3;
+			}
+			return;
+
+#if FD_STOP_BITS == 2
+		case 7: // Second stop bit
+			TX_STATE = 4;
+			return;
+#endif
+	}
+}
+
+#ifdef RX_NOTIFY
+/*
+**  Raise an event for the main loop and the callback.
+*/
+
+static inline void _rx_event(uint8_t event) {
+	fd_uart1.rx_events |= event;
+#ifdef RX_CALLBACK
+	if (fd_uart1.rx_callback) {
+		fd_uart1.rx_callback(event);
+	}
+#endif
+}
+#endif
+
+#ifdef RX_BRIDGE
+/*
+**  Pass a received byte to the transmitter, through the filter
+**  and map.
+*/
+
+static inline void _rx_bridge(unsigned char c) {
+	const uint8_t *p = fd_uart1.bridge_filter;
+
+	if (p && ! (pgm_read_byte(p + (c >> 3)) & (1 << (c & 7)))) {
+		return;
+	}
+
+	p = fd_uart1.bridge_map;
+	if (p) {
+		c = pgm_read_byte(p + c);
+	}
+
+	if (fd_uart1.bridge_full) {
+		// Line out can't keep up; drop it
+		return;
+	}
+
+	fd_uart1.bridge_byte = c;
+	fd_uart1.bridge_full = 1;
+	if (! TX_STATE) {
+		_tx_wakeup();
+	}
+}
+#endif
+
+#ifdef FRAMING
+/*
+**  Append a decoded byte to the frame. Unlike the plain ring buffer
+**  this never drops older chars; the frame is dropped instead.
+*/
+
+static inline void _frame_put(unsigned char c) {
+	uint8_t head = fd_uart1.rx_head;
+	uint8_t next = head == RING_BUFFER - 1 ? 0 : head + 1;
+
+	if (next == fd_uart1.rx_tail) {
+		fd_uart1.frame_bad = 1;
+		return;
+	}
+
+	fd_uart1.rx_buf[head] = c;
+#ifdef RX_TIMESTAMP
+	fd_uart1.rx_stamp[head] = fd_uart1.rx_clock;
+#endif
+	fd_uart1.rx_head = next;
+	fd_uart1.frame_len ++;
+#ifdef RUNNING_CRC
+	fd_uart1.crc_rx = _crc_update(fd_uart1.crc_rx, c);
+#endif
+}
+
+/*
+**  Delimiter received: queue the frame length, or drop the frame.
+*/
+
+static void _frame_end(void) {
+	uint8_t head = fd_uart1.frame_head;
+	uint8_t next = head == RX_FRAMES - 1 ? 0 : head + 1;
+
+	if (fd_uart1.frame_bad || next == fd_uart1.frame_tail) {
+		fd_uart1.rx_head = fd_uart1.frame_start;
+	} else if (fd_uart1.frame_len) {
+		fd_uart1.frame_q[head] = fd_uart1.frame_len;
+#ifdef RUNNING_CRC
+		fd_uart1.frame_crc[head] = fd_uart1.crc_rx;
+#endif
+		fd_uart1.frame_head = next;
+		_rx_event(FD_EVENT_FRAME);
+	}
+
+	fd_uart1.frame_start = fd_uart1.rx_head;
+	fd_uart1.frame_len = 0;
+	fd_uart1.frame_bad = 0;
+	fd_uart1.rx_dec = 0;
+	fd_uart1.rx_code = 0xff;
+#ifdef RUNNING_CRC
+	fd_uart1.crc_rx = CRC_INIT;
+#endif
+}
+
+/*
+**  Decode a received byte.
+*/
+
+static inline void _rx_frame(unsigned char c) {
+#ifdef FRAMING_SLIP
+	if (c == SLIP_END) {
+		_frame_end();
+		return;
+	}
+
+	if (c == SLIP_ESC) {
+		fd_uart1.rx_dec = 1;
+		return;
+	}
+
+	if (fd_uart1.rx_dec) {
+		fd_uart1.rx_dec = 0;
+		if (c == SLIP_ESC_END) {
+			c = SLIP_END;
+		} else if (c == SLIP_ESC_ESC) {
+			c = SLIP_ESC;
+		} else {
+			fd_uart1.frame_bad = 1;
+		}
+	}
+
+	_frame_put(c);
+#else
+	if (! c) {
+		if (fd_uart1.rx_dec) {
+			// Frame ended inside a block
+			fd_uart1.frame_bad = 1;
+		}
+		_frame_end();
+		return;
+	}
+
+	if (fd_uart1.rx_dec) {
+		fd_uart1.rx_dec --;
+		_frame_put(c);
+		return;
+	}
+
+	// c is a block code. Every block but the first and those after
+	// a 0xff code ends with a zero.
+	if (fd_uart1.rx_code != 0xff) {
+		_frame_put(0);
+	}
+
+	fd_uart1.rx_code = c;
+	fd_uart1.rx_dec = c - 1;
+#endif
+}
+#endif
+
+#ifdef RX_BLOCK
+/*
+**  Store a received byte in the block being filled. When it is
+**  full, go on to the other block if that has been handed back,
+**  or drop bytes until it is.
+*/
+
+static inline void _rx_block(unsigned char c) {
+	uint8_t *p = fd_uart1.blk_ptr;
+
+	if (! p) {
+		if (fd_uart1.blk_lost != 255) {
+			fd_uart1.blk_lost ++;
+		}
+		return;
+	}
+
+	*p++ = c;
+	if (p != fd_uart1.blk_end) {
+		fd_uart1.blk_ptr = p;
+		return;
+	}
+
+	if (fd_uart1.blk_full ++) {
+		p = 0;
+	} else {
+		fd_uart1.blk_fill ^= 1;
+		p = fd_uart1.blk_base[fd_uart1.blk_fill];
+		fd_uart1.blk_end = p + fd_uart1.blk_size;
+	}
+	fd_uart1.blk_ptr = p;
+	_rx_event(FD_EVENT_BLOCK);
+}
+#endif
+
+/*
+**  Deliver a received byte.
+*/
+
+static inline void _rx_byte(unsigned char c) {
+#ifdef XON_XOFF
+	if (c == XOFF) {
+		fd_uart1.tx_paused = 1;
+		return;
+	}
+
+	if (c == XON) {
+		fd_uart1.tx_paused = 0;
+		return;
+	}
+#endif
+
+#ifdef RX_HOOK
+	if (! RX_HOOK(c)) {
+		return;
+	}
+#endif
+
+#ifdef RX_BRIDGE
+	if (fd_uart1.bridge_mode) {
+		_rx_bridge(c);
+		if (fd_uart1.bridge_mode == FD_BRIDGE_FORWARD) {
+			return;
+		}
+	}
+#endif
+
+#if defined(FRAMING)
+	_rx_frame(c);
+#elif defined(RING_BUFFER)
+	// Put the latest char in the buffer
+	fd_uart1.rx_buf[fd_uart1.rx_head] = c;
+#ifdef RX_TIMESTAMP
+	fd_uart1.rx_stamp[fd_uart1.rx_head] = fd_uart1.rx_clock;
+#endif
+
+	// Increment the buffer head
+	if (fd_uart1.rx_head == RING_BUFFER - 1) {
+		fd_uart1.rx_head = 0;
+	} else {
+		fd_uart1.rx_head ++;
+	}
+
+	// If buffer is full,
+	if (fd_uart1.rx_head == fd_uart1.rx_tail) {
+		// Increment rx_tail to drop oldest character
+		if (fd_uart1.rx_tail == RING_BUFFER - 1) {
+			fd_uart1.rx_tail = 0;
+		} else {
+			fd_uart1.rx_tail ++;
+		}
+	}
+#elif defined(RX_BLOCK)
+	if (fd_uart1.blk_size) {
+		_rx_block(c);
+	} else {
+		fd_uart1.recv_byte = c;
+		SET_AVAILABLE();
+	}
+#else
+	fd_uart1.recv_byte = c;
+	SET_AVAILABLE();
+#endif
+
+#if defined(RUNNING_CRC) && ! defined(FRAMING)
+	fd_uart1.crc_rx = _crc_update(fd_uart1.crc_rx, c);
+#endif
+
+#ifdef RX_FLOW_CONTROL
+	if (! fd_uart1.rx_throttled && _rx_count() >= RX_HIGH_WATER) {
+		_rx_throttle();
+	}
+#endif
+
+#ifdef RX_WATERMARK
+	if (! fd_uart1.rx_marked && _rx_count() >= RX_WATERMARK) {
+		fd_uart1.rx_marked = 1;
+		_rx_event(FD_EVENT_WATERMARK);
+	}
+#endif
+
+#ifdef RX_DELIMITER
+	if (fd_uart1.line_count != 255) {
+		fd_uart1.line_count ++;
+	}
+
+	if (c == RX_DELIMITER) {
+		fd_uart1.line_length = fd_uart1.line_count;
+		fd_uart1.line_count = 0;
+		_rx_event(FD_EVENT_LINE);
+	}
+#endif
+}
+
+#ifdef LIN_SLAVE
+/*
+**  Add with end-around carry, as for the LIN checksum.
+*/
+
+static inline uint8_t _lin_add(uint8_t sum, uint8_t c) {
+	uint16_t s = sum + c;
+
+	return s > 255 ? s - 255 : s;
+}
+
+/*
+**  Return the PID for a 6 bit ID, with its two parity bits.
+*/
+
+static inline uint8_t _lin_pid(uint8_t id) {
+	uint8_t p0 = (id ^ id >> 1 ^ id >> 2 ^ id >> 4) & 1;
+	uint8_t p1 = ~(id >> 1 ^ id >> 3 ^ id >> 4 ^ id >> 5) & 1;
+
+	return id | p0 << 6 | p1 << 7;
+}
+
+static inline void _lin_error(void) {
+	if (fd_uart1.lin_errors != 255) {
+		fd_uart1.lin_errors ++;
+	}
+	fd_uart1.lin_phase = LIN_IDLE;
+}
+
+/*
+**  A break has ended. Count timer periods in rx state 5, so that
+**  INT0 can time the sync field edges.
+*/
+
+static inline void _lin_break(void) {
+	fd_uart1.lin_phase = LIN_SYNC;
+	fd_uart1.lin_edges = 0;
+	fd_uart1.lin_wraps = 0;
+	fd_uart1.lin_ticks = 0;
+	RX_STATE = 5;
+	OCR1B = 0;
+	TIFR = 1<<OCF1B;
+}
+
+/*
+**  A falling edge of the sync field. The first and fifth are 8 bits
+**  apart; set the bit time from them.
+*/
+
+static inline void _lin_sync_edge(uint8_t tcnt1) {
+	uint16_t now = fd_uart1.lin_ticks + tcnt1;
+
+	// Allow for a wrap which the rx ISR has not yet counted
+	if ((TIFR & 1<<OCF1B) && tcnt1 < (OCR1C >> 1)) {
+		now += OCR1C + 1;
+	}
+
+	if (! fd_uart1.lin_edges) {
+		fd_uart1.lin_start = now;
+	}
+
+	if (++fd_uart1.lin_edges < 5) {
+		return;
+	}
+
+	uint16_t bit = (now - fd_uart1.lin_start + 4) >> 3;
+
+	RX_STATE = 0;
+	_stop_rx();
+
+	if (bit < SERIAL_TOP + 1 - (SERIAL_TOP + 1) / 8 || bit > SERIAL_TOP + 1 + (SERIAL_TOP + 1) / 8 || bit > 256) {
+		_lin_error();
+		return;
+	}
+
+	// The transmitter is idle while a header is sent to us
+	OCR1C = bit - 1;
+	TCNT1 = 0;
+	fd_uart1.lin_half = bit >> 1;
+	fd_uart1.lin_phase = LIN_PID;
+}
+
+#ifdef LIN_RESPONSE
+/*
+**  Send our response to this PID, if we publish it.
+*/
+
+static inline uint8_t _lin_respond(uint8_t pid) {
+	const uint8_t *data;
+
+	// Application data is still waiting to go: do not overwrite it
+	if (fd_uart1.tx_len || ! SEND_READY) {
+		return 0;
+	}
+
+	uint8_t len = LIN_RESPONSE(pid & 0x3f, &data);
+
+	if (! len) {
+		return 0;
+	}
+	if (len > 8) {
+		len = 8;
+	}
+
+#ifdef LIN_CLASSIC
+	uint8_t sum = 0;
+#else
+	uint8_t sum = (pid & 0x3e) == 0x3c ? 0 : pid;
+#endif
+	for (uint8_t i = 0; i < len; ++i) {
+		sum = _lin_add(sum, data[i]);
+	}
+
+	// Data from the buffer, then the checksum from send_byte
+	fd_uart1.tx_ptr = data;
+	fd_uart1.tx_pgm = 0;
+	fd_uart1.tx_done = 0;
+	fd_uart1.tx_len = len;
+	fd_uart1.send_byte = ~sum;
+	CLEAR_SEND_READY();
+	if (! TX_STATE) {
+		_tx_wakeup();
+	}
+
+	fd_uart1.lin_count = len + 1;
+	fd_uart1.lin_phase = LIN_ECHO;
+	return 1;
+}
+#endif
+
+/*
+**  Handle a received byte of a LIN frame.
+*/
+
+static inline void _rx_lin(unsigned char c) {
+	uint8_t id;
+
+	switch(fd_uart1.lin_phase) {
+		case LIN_PID:
+			id = c & 0x3f;
+			if (_lin_pid(id) != c) {
+				_lin_error();
+				break;
+			}
+#ifdef LIN_RESPONSE
+			if (_lin_respond(c)) {
+				break;
+			}
+#endif
+			if (fd_uart1.lin_ready || ! (fd_uart1.lin_filter[id >> 3] & 1 << (id & 7))) {
+				// Not ours, or the last frame has not been taken
+				fd_uart1.lin_phase = LIN_IDLE;
+				break;
+			}
+
+			fd_uart1.lin_pid = c;
+			fd_uart1.lin_len = id < 32 ? 2 : id < 48 ? 4 : 8;
+			fd_uart1.lin_count = 0;
+#ifdef LIN_CLASSIC
+			fd_uart1.lin_sum = 0;
+#else
+			// Diagnostic frames 0x3c and 0x3d use the classic checksum
+			fd_uart1.lin_sum = (id & 0x3e) == 0x3c ? 0 : c;
+#endif
+			fd_uart1.lin_phase = LIN_DATA;
+			break;
+
+		case LIN_DATA:
+			if (fd_uart1.lin_count < fd_uart1.lin_len) {
+				fd_uart1.lin_buf[fd_uart1.lin_count ++] = c;
+				fd_uart1.lin_sum = _lin_add(fd_uart1.lin_sum, c);
+				break;
+			}
+
+			// This is the checksum
+			if (_lin_add(fd_uart1.lin_sum, c) != 0xff) {
+				_lin_error();
+				break;
+			}
+			fd_uart1.lin_ready = 1;
+			fd_uart1.lin_phase = LIN_IDLE;
+			_rx_event(FD_EVENT_FRAME);
+			break;
+
+		case LIN_ECHO:
+			if (! --fd_uart1.lin_count) {
+				fd_uart1.lin_phase = LIN_IDLE;
+			}
+			break;
+	}
+}
+#endif
+
+#ifdef MULTIDROP
+/*
+**  Filter a received 9 bit byte. Address bytes select or deselect
+**  this node, and data bytes are delivered only while selected.
+*/
+
+static inline void _rx_multidrop(unsigned char c) {
+	if (! fd_uart1.recv_nine) {
+		if (fd_uart1.rx_selected) {
+			_rx_byte(c);
+		}
+		return;
+	}
+
+	if (! fd_uart1.rx_filter) {
+		return;
+	}
+
+	if (c == fd_uart1.rx_address
+#ifdef MULTIDROP_BROADCAST
+		|| c == MULTIDROP_BROADCAST
+#endif
+	) {
+		fd_uart1.rx_selected = 1;
+#ifdef RX_NOTIFY
+		_rx_event(FD_EVENT_ADDRESS);
+#endif
+	} else {
+		fd_uart1.rx_selected = 0;
+	}
+}
+#endif
+
+/*
+**  The line is high after a byte. Pass the byte on.
+*/
+
+static inline void _rx_stop(unsigned char c) {
+#ifdef FD_TASK
+	fd_task_wake |= FD_WAKE_RX;
+#endif
+#if FD_PARITY && defined(FD_PARITY_DROP)
+	if (fd_uart1.recv_par_bad) {
+		return;
+	}
+#endif
+#ifdef RX_BREAK
+	if (fd_uart1.rx_low) {
+		if (! c) {
+			// Low for the whole frame
+			_rx_event(FD_EVENT_BREAK);
+			return;
+		}
+		_rx_event(FD_EVENT_FRAMING);
+	}
+#endif
+#ifdef LIN_SLAVE
+	_rx_lin(c);
+#elif defined(MULTIDROP)
+	_rx_multidrop(c);
+#else
+	_rx_byte(c);
+#endif
+}
+
+/*
+** Interrupt handler for timer1, TCCR1B, rx bits
+*/
+
+FD_HANDLER(TIMER1_COMPB_vect, _rx_handler)
+{
+	// Read the bit as early as possible, to try to hit the
+	// center mark
+	uint8_t read_bit = PINB & S1_RX_PIN;
+
+#ifdef RX_TIMESTAMP
+	fd_uart1.rx_clock ++;
+#endif
+
+	switch(RX_STATE) {
+		case 0: // Midpoint of start bit. Go on to first data bit.
+			RX_STATE = 2;
+			SET_RECV_BITS(FRAME_BITS);
+#if FD_PARITY
+			fd_uart1.recv_par = PARITY_INIT;
+#endif
+#ifdef RX_LOW_COUNT
+			fd_uart1.rx_low = 0;
+#endif
+			break;
+
+		case 1: // Reading start bit
+			// Go straight on to first data bit
+			RX_STATE = 2;
+			SET_RECV_BITS(FRAME_BITS);
+			break;
+
+		case 2: // Reading a data bit
+#ifdef MULTIDROP
+			if (RECV_BITS == 1) {
+				fd_uart1.recv_nine = read_bit;
+				RX_STATE = 3;
+				break;
+			}
+#elif FD_PARITY
+			if (RECV_BITS == 1) {
+				// Parity bit. It must match the data bits.
+				if (read_bit) {
+					fd_uart1.recv_par ^= 1;
+				}
+				fd_uart1.recv_par_bad = fd_uart1.recv_par;
+				if (fd_uart1.recv_par && fd_uart1.parity_errors != 255) {
+					fd_uart1.parity_errors ++;
+				}
+				RX_STATE = 3;
+				break;
+			}
+#endif
+			fd_uart1.recv_shift >>= 1;
+			if (read_bit) {
+				fd_uart1.recv_shift |= 0x80;
+#ifdef PARITY_XOR
+				fd_uart1.recv_par ^= 1;
+#endif
+			}
+
+			if (! DEC_RECV_BITS()) {
+				RX_STATE = 3;
+			}
+			break;
+
+		case 3: // Byte done, wait for high
+#ifdef RX_LOW_COUNT
+			if (! read_bit) {
+				if (fd_uart1.rx_low != 255) {
+					fd_uart1.rx_low ++;
+				}
+				break;
+			}
+#endif
+#ifdef LIN_SLAVE
+			if (fd_uart1.rx_low >= LIN_BREAK_LOW && ! fd_uart1.recv_shift) {
+				_lin_break();
+				_enable_int0();
+				break;
+			}
+#endif
+			if (read_bit) {
+				// Data bits are in the top of recv_shift
+				_rx_stop(fd_uart1.recv_shift >> (8 - FD_DATA_BITS));
+#ifdef RX_GAP_DETECT
+				// Keep the bit timer going to time the gap
+				fd_uart1.rx_gap = 0;
+				RX_STATE = 4;
+#else
+				RX_STATE = 0;
+				_stop_rx();
+#endif
+				_enable_int0();
+			}
+			break;
+
+#ifdef LIN_SLAVE
+		case 5: // After a break, count timer periods for the sync field
+			fd_uart1.lin_ticks += OCR1C + 1;
+			if (++fd_uart1.lin_wraps == LIN_SYNC_WRAPS) {
+				_lin_error();
+				RX_STATE = 0;
+				_stop_rx();
+			}
+			break;
+#endif
+
+#ifdef RX_GAP_DETECT
+		case 4: // Line idle, count bit times until the next start bit
+			if (fd_uart1.rx_gap != 255) {
+				fd_uart1.rx_gap ++;
+			}
+
+			if (fd_uart1.rx_gap == RX_GAP_FRAME) {
+				_rx_event(FD_EVENT_IDLE);
+#ifndef RX_TIMESTAMP
+				RX_STATE = 0;
+				_stop_rx();
+#endif
+			}
+			break;
+#endif
+	}
+}
+
+
+#ifdef RX_TIMESTAMP
+/*
+**  The clock counts timer periods by COMPB matches, and INT0 has
+**  just moved OCR1B from old. Keep it at one count per period: a
+**  match at old which was handled, and one at the new OCR1B still
+**  to come, would make two; neither would make none. A pending match
+**  counts as neither, as _start_rx() discards it.
+*/
+
+static inline void _rx_clock_moved(uint8_t old, uint8_t tcnt1) {
+	uint8_t handled = old < tcnt1 && ! (TIFR & 1<<OCF1B);
+	uint8_t to_come = OCR1B > tcnt1;
+
+	fd_uart1.rx_clock += 1 - handled - to_come;
+}
+#endif
+
+/*
+** This is called on the falling edge of INT0 (pin 7).
+** It is the beginning of a start bit.
+*/
+
+FD_HANDLER(INT0_vect, _int0_handler) {
+	uint8_t tcnt1 = TCNT1;
+#ifdef RX_TIMESTAMP
+	uint8_t old = OCR1B;
+#endif
+
+#ifdef RS485_DE_PIN
+	if (PORTB & RS485_DE_PIN) {
+		// Local echo of our own transmission
+		return;
+	}
+#endif
+
+#ifdef LIN_SLAVE
+	if (fd_uart1.lin_phase == LIN_SYNC) {
+		_lin_sync_edge(tcnt1);
+		return;
+	}
+
+	// Set sample time, half a bit after now. The bit time may have
+	// been changed by the sync field.
+	uint16_t sample = tcnt1 + fd_uart1.lin_half;
+
+	if (sample > OCR1C) {
+		sample -= OCR1C + 1;
+	}
+	OCR1B = sample;
+#else
+	// Set sample time, half a bit after now.
+	if (tcnt1 >= SERIAL_HALFBIT) {
+		OCR1B = tcnt1 - SERIAL_HALFBIT;
+	} else {
+		OCR1B = tcnt1 + SERIAL_HALFBIT;
+	}
+#endif
+
+#ifdef RX_GAP_DETECT
+	if (RX_STATE == 4) {
+		uint8_t gap = fd_uart1.rx_gap;
+
+		if (gap > RX_GAP_CHAR && gap < RX_GAP_FRAME) {
+			_rx_event(FD_EVENT_GAP);
+		}
+	}
+	RX_STATE = 0;
+#endif
+
+#ifdef RX_TIMESTAMP
+	_rx_clock_moved(old, tcnt1);
+#endif
 	_disable_int0();
 	_start_rx();
 }
+
+#ifdef FD_POLLED
+/*
+**  fdserial_poll()
+**    Run each handler whose interrupt is enabled and whose flag is
+**    set, clearing the flag first as the interrupt would. INT0 goes
+**    first, as it reads TCNT1 to time the start bit edge.
+*/
+
+void fdserial_poll(void) {
+	if ((GIMSK & 1<<INT0) && (GIFR & 1<<INTF0)) {
+		GIFR = 1<<INTF0;
+		_int0_handler();
+	}
+	if ((TIMSK & 1<<OCIE1A) && (TIFR & 1<<OCF1A)) {
+		TIFR = 1<<OCF1A;
+		_tx_handler();
+	}
+	if ((TIMSK & 1<<OCIE1B) && (TIFR & 1<<OCF1B)) {
+		TIFR = 1<<OCF1B;
+		_rx_handler();
+	}
+}
+#endif
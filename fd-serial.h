@@ -10,32 +10,587 @@
 
 // Size of rx buffer. Up to one less characters can be
 // received in the background and not yet read by the caller.
+// Define as 0 in CFLAGS for no buffer; one byte is then held.
+#ifndef RING_BUFFER
 #define RING_BUFFER 20
+#endif
+#if RING_BUFFER == 0
+#undef RING_BUFFER
+#elif RING_BUFFER < 4
+#error "RING_BUFFER must be 0, or 4 or more"
+#endif
+
+// Small RAM (optional). Define this here or in CFLAGS.
+//
+// FD_COMPACT is for the ATtiny25 and other parts with little SRAM.
+// tx_state and rx_state are kept in GPIOR0 and GPIOR1, the rx
+// available and send_ready flags are bits of GPIOR2, and the send
+// and receive bit counters share a byte. The GPIOR registers are
+// read and written in one cycle by the ISRs, and the flags are set
+// and cleared with sbi and cbi. The application must not use GPIOR0-2.
+// Combine it with a small RING_BUFFER (4 or more) or none at all.
+
+// #define FD_COMPACT
 
+// Bit rate. The Timer1 prescaler and count are worked out from this
+// and CPU_FREQ (default 8000000) when fd-serial.c is compiled.
 #ifndef SERIAL_RATE
-// Support for different bitrates is not presently implemented
 #define SERIAL_RATE 9600
 #endif
 
 #define S1_RX_PIN   (1<<PINB2)
 #define S1_TX_PIN   (1<<PORTB3)
 
+// Frame format. Define these here or in CFLAGS; the default is 8N1.
+//
+// FD_DATA_BITS is 5 to 8 (for 9 see MULTIDROP). FD_PARITY is worked
+// out a bit at a time as the data bits are shifted. Bytes received
+// with bad parity are counted (see fdserial_parity_errors()) and,
+// with FD_PARITY_DROP, not placed in the rx buffer. FD_STOP_BITS is
+// 1 or 2; the receiver only checks the first.
+
+#define FD_PARITY_NONE  0
+#define FD_PARITY_EVEN  1
+#define FD_PARITY_ODD   2
+#define FD_PARITY_MARK  3
+#define FD_PARITY_SPACE 4
+
+#ifndef FD_DATA_BITS
+#define FD_DATA_BITS 8
+#endif
+#ifndef FD_PARITY
+#define FD_PARITY FD_PARITY_NONE
+#endif
+#ifndef FD_STOP_BITS
+#define FD_STOP_BITS 1
+#endif
+// #define FD_PARITY_DROP
+
+#if FD_DATA_BITS < 5 || FD_DATA_BITS > 8
+#error "FD_DATA_BITS must be 5 to 8"
+#endif
+#if FD_PARITY > FD_PARITY_SPACE
+#error "Unknown FD_PARITY"
+#endif
+#if FD_STOP_BITS != 1 && FD_STOP_BITS != 2
+#error "FD_STOP_BITS must be 1 or 2"
+#endif
+
+// Flow control (optional). Define these here or in CFLAGS.
+//
+// FLOW_RTS_PIN is an output which is raised when the rx buffer
+// reaches RX_HIGH_WATER and lowered again when it drains to
+// RX_LOW_WATER. FLOW_CTS_PIN is an input; transmission pauses
+// at the next start bit while it is high. Both are active low,
+// as on the usual TTL serial adapters. The CTS pin has no pullup.
+//
+// XON_XOFF sends XOFF and XON at the same watermarks, and pauses
+// transmission between a received XOFF and XON. Received XON and
+// XOFF bytes are not placed in the rx buffer.
+
+// #define FLOW_RTS_PIN (1<<PORTB0)
+// #define FLOW_CTS_PIN (1<<PINB1)
+// #define XON_XOFF
+
+#define XON  0x11
+#define XOFF 0x13
+
+#if defined(FLOW_RTS_PIN) || defined(XON_XOFF)
+#define RX_FLOW_CONTROL
+#ifndef RING_BUFFER
+#error "Flow control requires RING_BUFFER"
+#endif
+#ifndef RX_HIGH_WATER
+// Leave room for what the sender has in flight when it is stopped
+#if RING_BUFFER >= 8
+#define RX_HIGH_WATER (RING_BUFFER - 4)
+#else
+#define RX_HIGH_WATER (RING_BUFFER - 2)
+#endif
+#endif
+#ifndef RX_LOW_WATER
+#define RX_LOW_WATER (RING_BUFFER / 4)
+#endif
+#endif
+
+#if defined(FLOW_CTS_PIN) || defined(XON_XOFF)
+#define TX_FLOW_CONTROL
+#endif
+
+// RS-485 driver enable (optional).
+//
+// RS485_DE_PIN is an output, raised in the tx ISR with the first
+// start bit and lowered at the end of the last stop bit, so the bus
+// is turned around within a bit time. Start bits seen on RX while
+// DE is raised are our own echo and are ignored. Tie RE to DE.
+
+// #define RS485_DE_PIN (1<<PORTB4)
+
+// 9 bit multidrop (optional).
+//
+// MULTIDROP sends and receives 9 data bits. A byte with the 9th bit
+// set is an address. After fdserial_set_address() the rx ISR drops
+// everything from an address other than ours (or MULTIDROP_BROADCAST,
+// if defined) until our address is seen again, and address bytes are
+// never placed in the rx buffer. FD_EVENT_ADDRESS is raised when we
+// are addressed. fdserial_send_address() sends an address byte.
+
+// #define MULTIDROP
+// #define MULTIDROP_BROADCAST 0xff
+
+#define FD_EVENT_ADDRESS   0x20
+
+#if defined(MULTIDROP) && (FD_DATA_BITS != 8 || FD_PARITY)
+#error "MULTIDROP uses 8 data bits and no parity"
+#endif
+
+// LIN slave (optional).
+//
+// LIN_SLAVE detects the break (a zero byte whose stop bit stays low
+// for LIN_BREAK_LOW more bit times), times the five falling edges of
+// the 0x55 sync field to set the bit rate to within 1/8 of a timer
+// count, and checks the parity of the PID which follows. The data
+// and checksum of frames whose ID has been passed to
+// fdserial_lin_subscribe() are received into a one frame buffer and
+// FD_EVENT_FRAME is raised when the checksum is good; fetch the frame
+// with fdserial_lin_recv(). Data lengths follow the LIN 1.3 ID coding
+// (2, 4 or 8 bytes). The checksum is the LIN 2 enhanced checksum
+// unless LIN_CLASSIC is defined. The rx buffer is not used.
+//
+// Define LIN_RESPONSE as the name of a function to publish responses.
+// It is called from the rx ISR with each valid ID and returns the
+// number of data bytes to send from *data, or 0 if the ID is not ours.
+// The checksum is added and the data sent straight away. No response
+// is sent, and LIN_RESPONSE is not called, while a byte or buffer
+// from the application is still waiting to be sent.
+//
+// The sync field must arrive within +/- 1/8 of SERIAL_RATE.
+
+// #define LIN_SLAVE
+// #define LIN_CLASSIC
+// #define LIN_RESPONSE my_lin_response
+
+#ifdef LIN_SLAVE
+#ifndef LIN_BREAK_LOW
+// 9 bits of zero byte + 2 = the 11 bit slave break threshold
+#define LIN_BREAK_LOW 2
+#endif
+#if defined(MULTIDROP) || defined(RX_TIMESTAMP) || defined(XON_XOFF)
+#error "LIN_SLAVE cannot be used with MULTIDROP, RX_TIMESTAMP or XON_XOFF"
+#endif
+#if FD_DATA_BITS != 8 || FD_PARITY
+#error "LIN is 8N1"
+#endif
+#if defined(FRAMING_SLIP) || defined(FRAMING_COBS)
+#error "LIN_SLAVE cannot be used with FRAMING"
+#endif
+#ifndef RX_NOTIFY
+#define RX_NOTIFY
+#endif
+#ifdef LIN_RESPONSE
+#ifndef SEND_BUFFER
+#define SEND_BUFFER
+#endif
+uint8_t LIN_RESPONSE(uint8_t id, const uint8_t **data);
+#endif
+#endif
+
+// Receive notification (optional).
+//
+// RX_WATERMARK raises FD_EVENT_WATERMARK when the rx buffer fills
+// to that many chars or more, and again once it has been read down
+// below that and filled back up. RX_DELIMITER raises FD_EVENT_LINE when that
+// byte is received, and fdserial_line_length() then gives the length
+// of the line including the delimiter. Events are collected with
+// fdserial_events(). With RX_CALLBACK the function registered with
+// fdserial_set_callback() is also called, from the rx ISR.
+
+// #define RX_WATERMARK 5
+// #define RX_DELIMITER '\n'
+// #define RX_CALLBACK
+
+#define FD_EVENT_WATERMARK 0x01
+#define FD_EVENT_LINE      0x02
+
+#if defined(RX_WATERMARK) || defined(RX_DELIMITER)
+#define RX_NOTIFY
+#endif
+
+#if defined(RX_WATERMARK) && !defined(RING_BUFFER)
+#error "RX_WATERMARK requires RING_BUFFER"
+#endif
+
+// Gap detection and timestamps (optional).
+//
+// With RX_GAP_DETECT the rx bit timer keeps running after each byte
+// and counts idle bit times. FD_EVENT_IDLE is raised after
+// RX_GAP_FRAME idle bit times (end of frame, like the Modbus RTU
+// t3.5), and FD_EVENT_GAP when a byte starts after more than
+// RX_GAP_CHAR but fewer than RX_GAP_FRAME (a t1.5 violation).
+// The defaults assume 11 bit characters.
+//
+// RX_TIMESTAMP keeps the bit timer running all the time as a 16 bit
+// clock of bit times, read with fdserial_clock(). Each byte in the rx
+// buffer is stamped with the clock at its stop bit, and
+// fdserial_timestamp() returns the stamp of the next byte
+// fdserial_recv() will return. Timing is to within one bit time.
+
+// #define RX_GAP_DETECT
+// #define RX_TIMESTAMP
+
+#define FD_EVENT_GAP       0x08
+#define FD_EVENT_IDLE      0x10
+
+#ifdef RX_TIMESTAMP
+#ifndef RING_BUFFER
+#error "RX_TIMESTAMP requires RING_BUFFER"
+#endif
+#ifndef RX_GAP_DETECT
+#define RX_GAP_DETECT
+#endif
+#endif
+
+#ifdef RX_GAP_DETECT
+#ifndef RX_GAP_CHAR
+#define RX_GAP_CHAR 16
+#endif
+#ifndef RX_GAP_FRAME
+#define RX_GAP_FRAME 38
+#endif
+#ifndef RX_NOTIFY
+#define RX_NOTIFY
+#endif
+#endif
+
+// Break and framing error reports (optional).
+//
+// With RX_BREAK a zero byte whose stop bit is low raises
+// FD_EVENT_BREAK once the line goes high again, and is not placed in
+// the rx buffer. Any other byte with a low stop bit raises
+// FD_EVENT_FRAMING and is kept. fdserial_send_break() is always
+// available.
+
+// #define RX_BREAK
+
+#define FD_EVENT_BREAK     0x40
+#define FD_EVENT_FRAMING   0x80
+
+#ifdef RX_BREAK
+#ifndef RX_NOTIFY
+#define RX_NOTIFY
+#endif
+#endif
+
+#if defined(RX_BREAK) || defined(LIN_SLAVE)
+// Count low bit times after the stop bit
+#define RX_LOW_COUNT
+#endif
+
+// Cooperative tasks (optional).
+//
+// With FD_TASK the rx ISR and tx ISR set wake bits for the task
+// scheduler in fd-task.c, so that tasks waiting in await_rx() or
+// await_tx_space() are only run when something has happened.
+
+// #define FD_TASK
+
+// Polled operation (optional).
+//
+// With FD_POLLED the tx, rx and INT0 handlers are not interrupt
+// routines, and interrupts must stay disabled. fdserial_poll() runs
+// each handler whose interrupt flag is set, and the calls which wait
+// call it themselves. Call it several times per bit time while a
+// byte is being sent or received. For code which cannot own the
+// vector table, such as the bootloader in fd-boot.c.
+
+// #define FD_POLLED
+
+#ifdef FD_POLLED
+#if defined(FD_TASK) || defined(LIN_SLAVE)
+#error "FD_POLLED cannot be used with FD_TASK or LIN_SLAVE"
+#endif
+#endif
+
+// Receive hook (optional).
+//
+// Define RX_HOOK as the name of a function to be called from the
+// rx ISR with each received byte, as soon as its stop bit has been
+// sampled. It runs in interrupt context. Return non-zero to also
+// place the byte in the rx buffer, or 0 to consume it. It may reply
+// with fdserial_trysend(), which never waits.
+
+// #define RX_HOOK my_rx_hook
+
+#ifdef RX_HOOK
+uint8_t RX_HOOK(unsigned char c);
+#endif
+
+// Bridge mode (optional).
+//
+// With RX_BRIDGE, fdserial_bridge() makes the rx ISR pass received
+// bytes straight to the transmitter, ahead of fdserial_send() data.
+// An optional 32 byte PROGMEM bitmap selects which bytes are passed
+// (bit c%8 of byte c/8 set = pass) and an optional 256 byte PROGMEM
+// table maps each byte to the one sent. One byte is held while the
+// previous one is sent; if the line out is slower, bytes are dropped.
+
+// #define RX_BRIDGE
+
+#define FD_BRIDGE_OFF     0  // Normal receive
+#define FD_BRIDGE_FORWARD 1  // Send received bytes, don't buffer them
+#define FD_BRIDGE_COPY    2  // Send received bytes and buffer them too
+
+// Buffer transmit (optional).
+//
+// With SEND_BUFFER, fdserial_send_buffer() and fdserial_send_buffer_P()
+// have the tx ISR read bytes directly from the caller's RAM or flash.
+// The done function, if any, is called from the tx ISR once the last
+// byte has been taken, so the buffer may then be reused.
+
+// #define SEND_BUFFER
+
+typedef void (*fdserial_done_t)(void);
+
+// Packet framing (optional).
+//
+// FRAMING_SLIP or FRAMING_COBS decodes frames in the rx ISR. Decoded
+// bytes go into the rx buffer and the length of each complete frame
+// into a queue of RX_FRAMES entries; read them with
+// fdserial_frame_available() and fdserial_recv_frame() rather than
+// fdserial_recv(). A frame which is malformed or does not fit in the
+// rx buffer is dropped whole. fdserial_send_frame() encodes from the
+// caller's buffer as it is sent. Each frame is sent with a delimiter
+// before and after it; empty frames are ignored on receive.
+
+// #define FRAMING_SLIP
+// #define FRAMING_COBS
+
+#define SLIP_END     0xc0
+#define SLIP_ESC     0xdb
+#define SLIP_ESC_END 0xdc
+#define SLIP_ESC_ESC 0xdd
+
+#define FD_EVENT_FRAME     0x04
+
+#if defined(FRAMING_SLIP) || defined(FRAMING_COBS)
+#define FRAMING
+#if defined(FRAMING_SLIP) && defined(FRAMING_COBS)
+#error "Choose one of FRAMING_SLIP and FRAMING_COBS"
+#endif
+#ifndef RING_BUFFER
+#error "FRAMING requires RING_BUFFER"
+#endif
+#ifdef XON_XOFF
+#error "XON_XOFF cannot be used with binary FRAMING"
+#endif
+#ifndef SEND_BUFFER
+#define SEND_BUFFER
+#endif
+#ifndef RX_NOTIFY
+#define RX_NOTIFY
+#endif
+#ifndef RX_FRAMES
+#define RX_FRAMES 4
+#endif
+#endif
+
+// Block receive (optional).
+//
+// With RX_BLOCK, fdserial_recv_blocks() gives the rx ISR two buffers
+// of the same size, and from then on it stores bytes straight into
+// one of them, and then the other, with no ring indices to wrap.
+// FD_EVENT_BLOCK is raised as each one fills; fdserial_block_ready()
+// returns the oldest full block, and fdserial_block_done() hands it
+// back once the application has finished with it. Bytes which arrive
+// while both blocks are full are dropped and counted. Until the first
+// call, and after fdserial_recv_blocks(0, 0, 0), bytes are received
+// one at a time as usual. RX_BLOCK needs RING_BUFFER 0.
+
+// #define RX_BLOCK
+
+// Shares its bit with FD_EVENT_FRAME, which cannot be raised here
+#define FD_EVENT_BLOCK     0x04
+
+#ifdef RX_BLOCK
+#ifdef RING_BUFFER
+#error "RX_BLOCK needs RING_BUFFER 0"
+#endif
+#if defined(FRAMING) || defined(LIN_SLAVE)
+#error "RX_BLOCK cannot be used with FRAMING or LIN_SLAVE"
+#endif
+#ifndef RX_NOTIFY
+#define RX_NOTIFY
+#endif
+#endif
+
+// Running CRC (optional).
+//
+// RUNNING_CRC 16 (CRC-16/CCITT: poly 0x1021, init 0xffff) or
+// RUNNING_CRC 8 (CRC-8: poly 0x07, init 0) is updated by the rx ISR
+// for each byte placed in the rx buffer, and by the tx ISR for each
+// byte taken from fdserial_send() or a send buffer. It is done a
+// nibble at a time with a 16 entry table in flash.
+//
+// With FRAMING, the tx CRC restarts for each frame and is sent at
+// the end of the frame, high byte first. The rx CRC of each frame,
+// taken over the frame including its CRC, is returned by
+// fdserial_frame_crc(). It is 0 for a good frame.
+
+// #define RUNNING_CRC 16
+
+#define FD_RX 1
+#define FD_TX 2
+
+#ifdef RUNNING_CRC
+#if RUNNING_CRC == 16
+typedef uint16_t fdserial_crc_t;
+#define CRC_INIT 0xffff
+#elif RUNNING_CRC == 8
+typedef uint8_t fdserial_crc_t;
+#define CRC_INIT 0
+#else
+#error "RUNNING_CRC must be 8 or 16"
+#endif
+#endif
+
 struct fd_uart {
+#ifndef FD_COMPACT
 	volatile uint8_t tx_state;
 	volatile uint8_t rx_state;
-	volatile unsigned char send_byte;  // byte presently being sent (shifted)
-	volatile unsigned char recv_byte;  // buffered received byte
+#endif
+	volatile unsigned char send_byte;  // byte waiting to be sent
+	volatile unsigned char send_shift; // byte presently being sent (shifted)
 	volatile unsigned char recv_shift; // rx data shifted into this byte
+#ifdef FD_COMPACT
+	volatile uint8_t bits;             // Bits to receive << 4 | bits to send
+#else
 	volatile uint8_t send_bits;        // Number of bits remaining to send
 	volatile uint8_t recv_bits;        // Number of bits remaining to receive
+	volatile uint8_t send_ready;       // 1 = send_byte is free
+#endif
+#ifndef RING_BUFFER
+	volatile unsigned char recv_byte;  // buffered received byte
+#ifndef FD_COMPACT
 	volatile uint8_t available;        // 1 = rx data available
-	volatile uint8_t send_ready;       // 1 = can send a byte
+#endif
+#endif
 	volatile uint16_t delay;           // Number of bit times to delay
+#if FD_PARITY
+	volatile uint8_t send_par;         // Parity of the bits sent so far
+	volatile uint8_t recv_par;         // Parity of the bits received so far
+	volatile uint8_t recv_par_bad;     // 1 = this byte has bad parity
+	volatile uint8_t parity_errors;
+#endif
+#ifdef RX_LOW_COUNT
+	volatile uint8_t rx_low;           // Bit times the stop bit stayed low
+#endif
+#ifdef MULTIDROP
+	volatile uint8_t send_addr;        // 1 = send_byte is an address
+	volatile uint8_t send_nine;        // 9th bit of send_shift
+	volatile uint8_t recv_nine;        // 9th bit of recv_shift
+	volatile uint8_t rx_address;       // Our address
+	volatile uint8_t rx_filter;        // 1 = drop data not addressed to us
+	volatile uint8_t rx_selected;      // 1 = last address was ours
+#endif
 #ifdef RING_BUFFER
 	volatile unsigned char rx_buf[RING_BUFFER];
 	volatile uint8_t rx_head;          // Index of next char to append
 	volatile uint8_t rx_tail;          // Index of next char to remove
 #endif
+#ifdef RX_FLOW_CONTROL
+	volatile uint8_t rx_throttled;     // 1 = sender has been asked to stop
+#endif
+#ifdef XON_XOFF
+	volatile uint8_t tx_paused;        // 1 = XOFF received
+	volatile unsigned char tx_ctrl;    // XON or XOFF to send next, or 0
+#endif
+#ifdef RX_NOTIFY
+	volatile uint8_t rx_events;        // FD_EVENT_* bits not yet collected
+#ifdef RX_CALLBACK
+	void (* volatile rx_callback)(uint8_t events);
+#endif
+#endif
+#ifdef RX_BRIDGE
+	volatile uint8_t bridge_mode;      // FD_BRIDGE_*
+	volatile uint8_t bridge_full;      // 1 = bridge_byte waiting to be sent
+	volatile unsigned char bridge_byte;
+	const uint8_t * volatile bridge_filter; // PROGMEM bitmap or 0
+	const uint8_t * volatile bridge_map;    // PROGMEM table or 0
+#endif
+#ifdef SEND_BUFFER
+	const uint8_t * volatile tx_ptr;   // Next byte of the buffer to send
+	volatile uint16_t tx_len;          // Bytes of the buffer left to send
+	volatile uint8_t tx_pgm;           // 1 = tx_ptr is in flash
+	volatile fdserial_done_t tx_done;
+#endif
+#ifdef FRAMING
+	volatile uint8_t frame_q[RX_FRAMES]; // Lengths of complete frames
+	volatile uint8_t frame_head;       // Index of next length to append
+	volatile uint8_t frame_tail;       // Index of next length to remove
+	volatile uint8_t frame_start;      // rx_head at start of this frame
+	volatile uint8_t frame_len;        // Decoded length of this frame
+	volatile uint8_t frame_bad;        // 1 = drop this frame at the end
+	volatile uint8_t rx_dec;           // SLIP: 1 after ESC. COBS: bytes left in block
+	volatile uint8_t rx_code;          // COBS code of this block
+	volatile uint8_t tx_frame;         // 1 = delimiter next, 2 = in frame
+	volatile uint8_t tx_enc;           // SLIP: byte after ESC. COBS: bytes left in block
+#ifdef RUNNING_CRC
+	volatile fdserial_crc_t frame_crc[RX_FRAMES];
+	const uint8_t * volatile tx_end;   // End of frame data; the CRC follows
+#endif
+#ifdef FRAMING_COBS
+	volatile uint8_t tx_zero;          // 1 = this block ends at a zero
+	volatile uint8_t next_code;        // Code of the next block, 0 = not found yet
+	volatile uint8_t next_zero;        // 1 = next block ends at a zero
+	volatile uint8_t scan_run;         // Non-zero bytes scanned in next block
+	volatile uint8_t scan_more;        // 1 = another block is to be found
+	const uint8_t * volatile scan_ptr; // Next byte to look at
+	const uint8_t * volatile scan_end;
+#endif
+#endif
+#ifdef RX_BLOCK
+	uint8_t * volatile blk_base[2];    // The two blocks
+	uint8_t * volatile blk_ptr;        // Next byte to fill, 0 = both full
+	uint8_t * volatile blk_end;        // End of the block being filled
+	volatile uint8_t blk_size;         // 0 = receive bytes as usual
+	volatile uint8_t blk_fill;         // Index of the block being filled
+	volatile uint8_t blk_full;         // Full blocks not yet done with
+	volatile uint8_t blk_lost;         // Bytes dropped, both blocks full
+#endif
+#ifdef RUNNING_CRC
+	volatile fdserial_crc_t crc_rx;
+	volatile fdserial_crc_t crc_tx;
+#endif
+#ifdef RX_GAP_DETECT
+	volatile uint8_t rx_gap;           // Idle bit times since last stop bit
+#endif
+#ifdef RX_TIMESTAMP
+	volatile uint16_t rx_clock;        // Bit times, free running
+	volatile uint16_t rx_stamp[RING_BUFFER]; // rx_clock at each byte's stop bit
+#endif
+#ifdef LIN_SLAVE
+	volatile uint8_t lin_phase;        // Where we are in the frame
+	volatile uint8_t lin_edges;        // Sync field falling edges seen
+	volatile uint8_t lin_wraps;        // Timer periods since the break
+	volatile uint16_t lin_ticks;       // Timer counts at the last wrap
+	volatile uint16_t lin_start;       // Timer counts at the first sync edge
+	volatile uint8_t lin_half;         // Half a bit in timer counts
+	volatile uint8_t lin_pid;          // PID of the frame being received
+	volatile uint8_t lin_len;          // Its data length
+	volatile uint8_t lin_count;        // Data bytes received, or echoes left
+	volatile uint8_t lin_sum;          // Checksum so far
+	volatile uint8_t lin_ready;        // 1 = lin_buf holds a complete frame
+	volatile uint8_t lin_errors;       // Parity, checksum and sync errors
+	volatile uint8_t lin_filter[8];    // Subscribed IDs, one bit each
+	volatile uint8_t lin_buf[8];
+#endif
+#ifdef RX_WATERMARK
+	volatile uint8_t rx_marked;        // 1 = FD_EVENT_WATERMARK raised
+#endif
+#ifdef RX_DELIMITER
+	volatile uint8_t line_count;       // Chars received since last delimiter
+	volatile uint8_t line_length;      // Length of last complete line
+#endif
 };
 
 // Initialise data structures, timer, interrupts and output pin
@@ -46,14 +601,163 @@ void fdserial_init(void);
 
 uint8_t fdserial_available(void);
 
-// Return true when the tx sender is idle
+// Return true when a byte can be sent without waiting
 
 uint8_t fdserial_sendok(void);
 
+// Send a byte. Waits only while the previous byte has not yet
+// started to be shifted out.
+
 void fdserial_send(unsigned char send_arg);
 
+// Send a byte if that can be done without waiting. Return 1 if the
+// byte was accepted. Safe to call from interrupt context.
+
+uint8_t fdserial_trysend(unsigned char send_arg);
+
 unsigned char fdserial_recv(void);
 
+#ifdef FD_POLLED
+// Run the handlers whose interrupt flags are set
+
+void fdserial_poll(void);
+#endif
+
+#if FD_PARITY
+// Return and clear the count of bytes received with bad parity
+
+uint8_t fdserial_parity_errors(void);
+#endif
+
+#ifdef LIN_SLAVE
+// Receive (on non-zero) or ignore frames with this ID (0-63)
+
+void fdserial_lin_subscribe(uint8_t id, uint8_t on);
+
+// Copy a received frame to buf (8 bytes) and its ID to *id.
+// Return the data length, or 0 if there is no frame.
+
+uint8_t fdserial_lin_recv(uint8_t *id, uint8_t *buf);
+
+// Return and clear the count of frames dropped for errors
+
+uint8_t fdserial_lin_errors(void);
+#endif
+
+#ifdef MULTIDROP
+// Accept only data sent to addr (and MULTIDROP_BROADCAST)
+
+void fdserial_set_address(uint8_t addr);
+
+// Accept all data, whatever it is addressed to
+
+void fdserial_clear_address(void);
+
+// Send an address byte, with the 9th bit set
+
+void fdserial_send_address(uint8_t addr);
+#endif
+
+#ifdef RX_NOTIFY
+// Return and clear the FD_EVENT_* bits raised since the last call
+
+uint8_t fdserial_events(void);
+#endif
+
+#ifdef RX_TIMESTAMP
+// Return the bit time clock
+
+uint16_t fdserial_clock(void);
+
+// Return the stop bit time of the next byte fdserial_recv() returns
+
+uint16_t fdserial_timestamp(void);
+#endif
+
+#ifdef RX_DELIMITER
+// Return the length of the last complete line, including RX_DELIMITER
+
+uint8_t fdserial_line_length(void);
+#endif
+
+#ifdef RX_BRIDGE
+// Set the bridge mode, and the filter bitmap and map table (or 0)
+
+void fdserial_bridge(uint8_t mode, const uint8_t *filter_P, const uint8_t *map_P);
+#endif
+
+#ifdef RX_CALLBACK
+// Register a function to be called from the rx ISR for each event
+
+void fdserial_set_callback(void (*callback)(uint8_t events));
+#endif
+
+#ifdef SEND_BUFFER
+// Send len bytes from RAM or from flash without copying them.
+// Waits for any previous buffer to be taken first.
+
+void fdserial_send_buffer(const void *buf, uint16_t len, fdserial_done_t done);
+
+void fdserial_send_buffer_P(const void *buf_P, uint16_t len, fdserial_done_t done);
+
+// Return true while a buffer is being sent
+
+uint8_t fdserial_buffer_busy(void);
+#endif
+
+#ifdef FRAMING
+// Return the length of the next complete frame, or 0 if none
+
+uint8_t fdserial_frame_available(void);
+
+// Copy the next frame into buf, waiting for one if necessary.
+// Return its length. Bytes beyond size are discarded.
+
+uint8_t fdserial_recv_frame(unsigned char *buf, uint8_t size);
+
+// Encode and send len bytes from RAM or from flash, as one frame.
+// done is called from the tx ISR after the closing delimiter is taken.
+
+void fdserial_send_frame(const void *buf, uint16_t len, fdserial_done_t done);
+
+void fdserial_send_frame_P(const void *buf_P, uint16_t len, fdserial_done_t done);
+#endif
+
+#ifdef RX_BLOCK
+// Receive into blocks a and b of size bytes each, starting with a.
+// A size of 0 goes back to receiving bytes one at a time.
+
+void fdserial_recv_blocks(uint8_t *a, uint8_t *b, uint8_t size);
+
+// Return the oldest full block, or 0 if none
+
+uint8_t *fdserial_block_ready(void);
+
+// Hand the block returned by fdserial_block_ready() back to the ISR
+
+void fdserial_block_done(void);
+
+// Return and clear the count of bytes dropped with both blocks full
+
+uint8_t fdserial_block_overruns(void);
+#endif
+
+#ifdef RUNNING_CRC
+// Restart the CRC of FD_RX and/or FD_TX
+
+void fdserial_crc_reset(uint8_t dir);
+
+// Return the CRC of FD_RX or FD_TX so far
+
+fdserial_crc_t fdserial_crc(uint8_t dir);
+
+#ifdef FRAMING
+// Return the CRC of the next complete frame (0 = good)
+
+fdserial_crc_t fdserial_frame_crc(void);
+#endif
+#endif
+
 // Set an alarm for a specified number of ms hence
 
 void fdserial_alarm(uint32_t duration);
@@ -62,4 +766,9 @@ void fdserial_alarm(uint32_t duration);
 
 void fdserial_delay(uint32_t duration);
 
+// Hold the line low for bit_times, after anything already queued,
+// then high for at least one bit time
+
+void fdserial_send_break(uint16_t bit_times);
+
 #endif
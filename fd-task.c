@@ -0,0 +1,143 @@
+/*
+**  Tullnet cooperative tasks for fd-serial
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  ATtiny85
+**     This code uses the watchdog timer interrupt for ticks
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "fd-task.h"
+
+#ifndef FD_TASK
+#error "fd-serial must be compiled with FD_TASK for fd-task"
+#endif
+
+volatile uint8_t fd_task_wake;
+
+static volatile uint16_t ticks;
+
+static struct fd_task *tasks;
+
+/*
+**  Start the watchdog in interrupt mode, with the shortest
+**  period (16 ms). It does not reset the CPU.
+*/
+
+void fd_task_init(void) {
+	uint8_t sreg = SREG;
+	cli();
+	MCUSR &= ~( 1<<WDRF );
+	WDTCR = 1<<WDCE | 1<<WDE;
+	WDTCR = 1<<WDIE;
+	SREG = sreg;
+}
+
+/*
+**  fd_task_add(task, fn)
+**    Add a task to the end of the list.
+*/
+
+void fd_task_add(struct fd_task *task, fd_task_fn fn) {
+	struct fd_task **p = &tasks;
+
+	task->lc = 0;
+	task->wait = 0;
+	task->done = 0;
+	task->fn = fn;
+	task->next = 0;
+
+	while (*p) {
+		p = &(*p)->next;
+	}
+	*p = task;
+}
+
+/*
+**  fd_task_now()
+**    Return the count of ticks, which wraps at 65536.
+*/
+
+uint16_t fd_task_now(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t t = ticks;
+	SREG = sreg;
+
+	return t;
+}
+
+/*
+**  fd_task_expired(until)
+**    True if the tick count is at or past until, allowing for wrap.
+*/
+
+uint8_t fd_task_expired(uint16_t until) {
+	return (int16_t) (fd_task_now() - until) >= 0;
+}
+
+/*
+**  fd_task_run()
+**
+**  Call each task which is ready or whose wake bits have been set,
+**  then sleep until an interrupt if none of them yielded. A wake bit
+**  set while the tasks run is kept for the next pass, and sei()
+**  delays interrupts by one instruction, so it cannot be lost
+**  between the check and sleep_cpu().
+*/
+
+void fd_task_run(void) {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	while (1) {
+		uint8_t yielded = 0;
+
+		cli();
+		uint8_t wake = fd_task_wake;
+		fd_task_wake = 0;
+		sei();
+
+		for (struct fd_task *t = tasks; t; t = t->next) {
+			if (t->done || (t->wait && ! (t->wait & wake))) {
+				continue;
+			}
+
+			t->wait = 0;
+			switch (t->fn(t)) {
+				case FD_TASK_YIELDED:
+					yielded = 1;
+					break;
+
+				case FD_TASK_DONE:
+					t->done = 1;
+					break;
+			}
+		}
+
+		if (yielded) {
+			continue;
+		}
+
+		cli();
+		if (! fd_task_wake) {
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+}
+
+/*
+**  Watchdog interrupt: advance the tick.
+*/
+
+ISR(WDT_vect) {
+	ticks ++;
+	fd_task_wake |= FD_WAKE_TICK;
+}
@@ -0,0 +1,140 @@
+/*
+**  Tullnet cooperative tasks for fd-serial
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Tasks are protothreads: a task is a function which is called
+**  again and again by fd_task_run(), and which carries on from the
+**  await where it last returned. The await macros return to the
+**  scheduler while their condition is false, and the scheduler only
+**  calls the task again once the matching ISR has set a wake bit.
+**  When no task can run, the CPU sleeps in idle mode.
+**
+**  fd-serial must be compiled with FD_TASK, so that its ISRs set
+**  the wake bits.
+**
+**  Usage:
+**
+**     TASK(echo) {
+**         TASK_BEGIN();
+**         while (1) {
+**             await_rx(1);
+**             await_tx_space();
+**             fdserial_send(fdserial_recv());
+**         }
+**         TASK_END();
+**     }
+**
+**     static struct fd_task echo_task;
+**     fd_task_add(&echo_task, echo);
+**     fd_task_run();
+**
+**  As with all protothreads, local variables do not keep their
+**  values across an await. Use static variables, or keep state in
+**  a struct which begins with the struct fd_task.
+**  Do not use switch statements in a task, and put no more than one
+**  await on a line.
+*/
+
+#ifndef _FD_TASK_H
+#define _FD_TASK_H
+
+#include <stdint.h>
+
+#include "fd-serial.h"
+
+// Wake bits, set by the ISRs
+
+#define FD_WAKE_RX   0x01  // A byte or event was received
+#define FD_WAKE_TX   0x02  // fdserial_send() would not wait
+#define FD_WAKE_TICK 0x04  // The tick count has advanced
+
+extern volatile uint8_t fd_task_wake;
+
+// Ticks come from the watchdog interrupt, every 16 ms
+
+#define FD_TASK_TICK_MS 16
+#define FD_TASK_MS(ms) (((ms) + FD_TASK_TICK_MS - 1) / FD_TASK_TICK_MS)
+
+// Task function return values
+
+#define FD_TASK_WAITING 0
+#define FD_TASK_YIELDED 1
+#define FD_TASK_DONE    2
+
+struct fd_task;
+
+typedef uint8_t (*fd_task_fn)(struct fd_task *task);
+
+struct fd_task {
+	uint16_t lc;                // Line to resume at, 0 = start
+	uint8_t wait;               // FD_WAKE_* bits waited for, 0 = ready
+	uint8_t done;               // 1 = returned from TASK_END
+	uint16_t until;             // Tick at which await_timeout() ends
+	fd_task_fn fn;
+	struct fd_task *next;
+};
+
+#define TASK(name) static uint8_t name(struct fd_task *task)
+
+#define TASK_BEGIN() switch (task->lc) { case 0:
+
+#define TASK_END() } task->lc = 0; return FD_TASK_DONE
+
+// Return to the scheduler until cond is true, checking it again
+// whenever one of the wake bits is set
+
+#define TASK_WAIT_UNTIL(wake, cond) \
+	do { \
+		task->lc = __LINE__; case __LINE__: \
+		if (! (cond)) { \
+			task->wait = (wake); \
+			return FD_TASK_WAITING; \
+		} \
+	} while (0)
+
+// Let the other tasks run, then carry on
+
+#define TASK_YIELD() \
+	do { \
+		task->lc = __LINE__; \
+		return FD_TASK_YIELDED; \
+		case __LINE__: ; \
+	} while (0)
+
+// Wait until at least n bytes have been received
+
+#define await_rx(n) TASK_WAIT_UNTIL(FD_WAKE_RX, fdserial_available() >= (n))
+
+// Wait until a byte can be sent without waiting
+
+#define await_tx_space() TASK_WAIT_UNTIL(FD_WAKE_TX, fdserial_sendok())
+
+// Wait for a number of ticks (see FD_TASK_MS)
+
+#define await_timeout(ticks) \
+	do { \
+		task->until = fd_task_now() + (ticks); \
+		TASK_WAIT_UNTIL(FD_WAKE_TICK, fd_task_expired(task->until)); \
+	} while (0)
+
+// Start the tick
+
+void fd_task_init(void);
+
+// Add a task. It is first called from fd_task_run().
+
+void fd_task_add(struct fd_task *task, fd_task_fn fn);
+
+// Run the tasks. Never returns.
+
+void fd_task_run(void);
+
+// Return the tick count
+
+uint16_t fd_task_now(void);
+
+// True once the tick count has reached until
+
+uint8_t fd_task_expired(uint16_t until);
+
+#endif
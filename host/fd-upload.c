@@ -0,0 +1,379 @@
+/*
+**  Tullnet serial bootloader uploader
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Sends an Intel hex file to fd-boot.
+**
+**  Usage: fd-upload -p port [-b rate] [-n] file.hex
+**
+**    -p port    Serial port, or the pty made by sim-loopback -m pty
+**    -b rate    Bit rate, as BOOT_RATE (default 38400)
+**    -n         Do not start the application afterwards
+**
+**  Start fd-upload, then reset the board: the bootloader only waits
+**  for the host for a moment after reset. Pages which are all 0xff
+**  are skipped, except page 0, which goes last (see fd-boot.c). A
+**  page which is not answered, or fails its CRC, is sent again after
+**  the bootloader has been found again.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/time.h>
+
+#define FLASH_SIZE  8192
+#define RETRIES     5
+#define SYNC_MS     10000              // Time to wait for a reset
+#define REPLY_MS    500                // Time to wait for a page answer
+
+static uint8_t image[FLASH_SIZE];
+static int image_top;                  // One past the highest byte loaded
+
+static int fd;
+static int page_size;
+static int trampoline;
+
+static double now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: fd-upload -p port [-b rate] [-n] file.hex\n");
+	exit(2);
+}
+
+static int hex_byte(const char *s) {
+	unsigned v;
+
+	return sscanf(s, "%2x", &v) == 1 ? (int) v : -1;
+}
+
+/*
+**  Load an Intel hex file into image. Return 0 on success.
+*/
+
+static int load_hex(const char *file) {
+	FILE *f = fopen(file, "r");
+	char line[600];
+	int lineno = 0;
+	long base = 0;
+
+	if (! f) {
+		perror(file);
+		return -1;
+	}
+	memset(image, 0xff, sizeof(image));
+
+	while (fgets(line, sizeof(line), f)) {
+		int len, addr, type, sum;
+		int bytes[256];
+
+		lineno ++;
+		if (line[0] != ':') {
+			continue;
+		}
+
+		len = hex_byte(line + 1);
+		if (len < 0 || (int) strlen(line) < 11 + len * 2) {
+			fprintf(stderr, "%s:%d: short record\n", file, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		sum = 0;
+		for (int i = 0; i < len + 5; ++i) {
+			if ((bytes[i] = hex_byte(line + 1 + i * 2)) < 0) {
+				fprintf(stderr, "%s:%d: bad hex\n", file, lineno);
+				fclose(f);
+				return -1;
+			}
+			sum += bytes[i];
+		}
+		if (sum & 0xff) {
+			fprintf(stderr, "%s:%d: bad checksum\n", file, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		addr = bytes[1] << 8 | bytes[2];
+		type = bytes[3];
+
+		switch (type) {
+			case 0:
+				for (int i = 0; i < len; ++i) {
+					long a = base + addr + i;
+
+					if (a >= FLASH_SIZE) {
+						fprintf(stderr, "%s:%d: address %04lx is past the end of flash\n", file, lineno, a);
+						fclose(f);
+						return -1;
+					}
+					image[a] = bytes[4 + i];
+					if (a >= image_top) {
+						image_top = a + 1;
+					}
+				}
+				break;
+
+			case 1:
+				fclose(f);
+				return 0;
+
+			case 2:
+				base = (long) (bytes[4] << 8 | bytes[5]) << 4;
+				break;
+
+			case 4:
+				base = (long) (bytes[4] << 8 | bytes[5]) << 16;
+				break;
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static speed_t baud(long rate) {
+	switch (rate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+	}
+	fprintf(stderr, "Unsupported rate %ld\n", rate);
+	exit(2);
+}
+
+static int open_port(const char *port, long rate) {
+	struct termios t;
+	int f = open(port, O_RDWR | O_NOCTTY);
+
+	if (f < 0) {
+		perror(port);
+		return -1;
+	}
+	if (tcgetattr(f, &t) == 0) {
+		cfmakeraw(&t);
+		t.c_cflag |= CLOCAL | CREAD;
+		cfsetispeed(&t, baud(rate));
+		cfsetospeed(&t, baud(rate));
+		tcsetattr(f, TCSANOW, &t);
+	}
+	return f;
+}
+
+/*
+**  Read up to n bytes, waiting no longer than ms in all.
+**  Return the number read.
+*/
+
+static int read_wait(uint8_t *buf, int n, int ms) {
+	double end = now() + ms / 1000.0;
+	int got = 0;
+
+	while (got < n) {
+		struct pollfd p = { fd, POLLIN, 0 };
+		int left = (end - now()) * 1000;
+
+		if (left <= 0 || poll(&p, 1, left) <= 0) {
+			break;
+		}
+
+		int r = read(fd, buf + got, n - got);
+
+		if (r <= 0) {
+			break;
+		}
+		got += r;
+	}
+	return got;
+}
+
+static void send_bytes(const uint8_t *buf, int n) {
+	if (write(fd, buf, n) != n) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/*
+**  Send 'S' every 100 ms until the bootloader answers. A bootloader
+**  part way through a page takes the 'S's as data, and answers that
+**  page before it hears the next one.
+*/
+
+static int sync_boot(int ms) {
+	double end = now() + ms / 1000.0;
+	uint8_t reply[4];
+
+	while (now() < end) {
+		send_bytes((const uint8_t *) "S", 1);
+
+		int n = read_wait(reply, 1, 100);
+
+		if (n == 1 && reply[0] == 'S' && read_wait(reply + 1, 3, 100) == 3) {
+			page_size = reply[1];
+			trampoline = reply[2] | reply[3] << 8;
+			if (page_size < 2 || page_size & (page_size - 1) || trampoline > FLASH_SIZE) {
+				fprintf(stderr, "Bad answer from the bootloader\n");
+				return -1;
+			}
+			// Drop the answers to any more 'S's still on the way
+			while (read_wait(reply, 1, 50) == 1) {
+			}
+			return 0;
+		}
+	}
+	fprintf(stderr, "No answer from the bootloader\n");
+	return -1;
+}
+
+static uint16_t crc16(uint16_t crc, uint8_t c) {
+	crc ^= (uint16_t) c << 8;
+	for (int i = 0; i < 8; ++i) {
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/*
+**  Send one page. Return 0 once it has been written and read back.
+*/
+
+static int send_page(int addr) {
+	for (int tries = 0; tries < RETRIES; ++tries) {
+		uint8_t buf[3 + 256 + 2];
+		uint16_t crc = 0xffff;
+		int n = 0;
+		uint8_t reply = 0;
+
+		buf[n++] = 'P';
+		buf[n++] = addr & 0xff;
+		buf[n++] = addr >> 8;
+		memcpy(buf + n, image + addr, page_size);
+		n += page_size;
+		for (int i = 1; i < n; ++i) {
+			crc = crc16(crc, buf[i]);
+		}
+		buf[n++] = crc >> 8;
+		buf[n++] = crc & 0xff;
+
+		send_bytes(buf, n);
+		if (read_wait(&reply, 1, REPLY_MS) == 1) {
+			switch (reply) {
+				case 'K':
+					return 0;
+
+				case 'A':
+					fprintf(stderr, "Page %04x: bad address\n", addr);
+					return -1;
+
+				case 'V':
+					fprintf(stderr, "Page %04x: verify failed\n", addr);
+					return -1;
+			}
+		}
+
+		fprintf(stderr, "Page %04x: %s, retrying\n", addr, reply == 'C' ? "CRC error" : "no answer");
+		if (sync_boot(1000)) {
+			return -1;
+		}
+	}
+
+	fprintf(stderr, "Page %04x: giving up\n", addr);
+	return -1;
+}
+
+static int blank(int addr) {
+	for (int i = 0; i < page_size; ++i) {
+		if (image[addr + i] != 0xff) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *port = NULL;
+	long rate = 38400;
+	int start = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:np:")) != -1) {
+		switch (opt) {
+			case 'b': rate = atol(optarg); break;
+			case 'n': start = 0; break;
+			case 'p': port = optarg; break;
+			default:
+				usage();
+		}
+	}
+
+	if (! port || argc - optind != 1) {
+		usage();
+	}
+	if (load_hex(argv[optind])) {
+		return 2;
+	}
+	if ((fd = open_port(port, rate)) < 0) {
+		return 2;
+	}
+
+	fprintf(stderr, "Waiting for the bootloader (reset the board)\n");
+	if (sync_boot(SYNC_MS)) {
+		return 1;
+	}
+	if (image_top > trampoline) {
+		fprintf(stderr, "%s: %d bytes, but only %d are free below the bootloader\n",
+			argv[optind], image_top, trampoline);
+		return 1;
+	}
+
+	double t0 = now();
+	int pages = 0;
+
+	// Page 0 last: until it is written, a reset still reaches the bootloader
+	for (int addr = page_size; addr < trampoline; addr += page_size) {
+		if (blank(addr)) {
+			continue;
+		}
+		if (send_page(addr)) {
+			return 1;
+		}
+		pages ++;
+	}
+	if (send_page(0)) {
+		return 1;
+	}
+	pages ++;
+
+	double t = now() - t0;
+
+	printf("%d pages (%d bytes) in %.2f s, %.0f bytes/s\n",
+		pages, pages * page_size, t, pages * page_size / t);
+
+	if (start) {
+		uint8_t reply;
+
+		send_bytes((const uint8_t *) "G", 1);
+		if (read_wait(&reply, 1, REPLY_MS) != 1 || reply != 'G') {
+			fprintf(stderr, "The application did not start\n");
+			return 1;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
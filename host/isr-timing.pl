@@ -0,0 +1,893 @@
+#!/usr/bin/perl -w
+#
+#  Tullnet fd-serial interrupt timing analysis
+#  (C) 2010, Nick Andrew <nick@tull.net>
+#
+#  Reads the disassembly of a linked ATtiny85 image and works out,
+#  for each fd-serial ISR, the cycles from the vector to the pin
+#  access (TCNT1 read in INT0, PINB read in COMPB, PORTB write in
+#  COMPA) and to the reti, for each value of the state variable which
+#  the ISR switches on. From these it finds the worst case for all
+#  three interrupts becoming pending in the same bit, and for each
+#  bit rate how far from the bit centre a received bit can be
+#  sampled, and how far a sent edge can be from where it should be.
+#
+#  The model is deliberately pessimistic:
+#
+#    - An interrupt may wait for the whole of any other ISR, or for
+#      the longest cli() section in the rest of the program, plus one
+#      4 cycle instruction, before it is served.
+#    - INT0 has the highest priority, then COMPA, then COMPB, so a
+#      waiting COMPA may also be overtaken by INT0, and a waiting
+#      COMPB by COMPA.
+#    - The start edge and the sample can both be late by their worst
+#      case in the same byte, and the far end's clock can be off by
+#      -e percent in either direction.
+#    - A loop is counted once, and is reported; the result for that
+#      ISR is then a lower bound.
+#
+#  Usage: isr-timing.pl [options] file.elf
+#
+#    -c hz       CPU clock (default 8000000)
+#    -d bits     Data bits in a frame, including parity (default 8)
+#    -e percent  Clock error allowed at the far end (default 0)
+#    -l percent  Largest safe offset, as a percentage of a bit (default 40)
+#    -o prog     objdump to use (default avr-objdump)
+#    -r rate     Exit non-zero if this rate is not safe
+#    -s          Print one line: the longest INT0, COMPA and COMPB, the
+#                maximum safe rate, and with -r, ok or UNSAFE
+#    -v          Also list the cli() sections
+
+use strict;
+no warnings 'recursion';
+
+use Getopt::Std;
+
+my %opts;
+getopts('c:d:e:l:o:r:sv', \%opts) or usage();
+
+my $cpu_freq = $opts{'c'} || 8000000;
+my $data_bits = $opts{'d'} || 8;
+my $clock_error = ($opts{'e'} || 0) / 100;
+my $limit = (defined $opts{'l'} ? $opts{'l'} : 40) / 100;
+my $objdump = $opts{'o'} || 'avr-objdump';
+
+my $elf = shift @ARGV || usage();
+
+# ATtiny85 vectors, and the I/O registers the ISRs time against
+
+my %vector_names = (
+	1 => 'INT0', 2 => 'PCINT0', 3 => 'TIMER1_COMPA', 4 => 'TIMER1_OVF',
+	5 => 'TIMER0_OVF', 6 => 'EE_RDY', 7 => 'ANA_COMP', 8 => 'ADC',
+	9 => 'TIMER1_COMPB', 10 => 'TIMER0_COMPA', 11 => 'TIMER0_COMPB',
+	12 => 'WDT', 13 => 'USI_START', 14 => 'USI_OVF',
+);
+
+my @standard_rates = (300, 600, 1200, 2400, 4800, 9600, 14400, 19200,
+	28800, 38400, 57600, 76800, 115200);
+
+my $VEC_INT0 = 1;
+my $VEC_COMPA = 3;
+my $VEC_COMPB = 9;
+
+my $IO_GPIOR0 = 0x11;
+my $IO_PINB = 0x16;
+my $IO_PORTB = 0x18;
+my $IO_TCNT1 = 0x2f;
+my $IO_SREG = 0x3f;
+my $RX_BIT = 2;
+my $TX_BIT = 3;
+
+# Interrupt response, rjmp in the vector table, and the longest
+# instruction which must finish (or wakeup from sleep) first
+
+my $RESPONSE = 4;
+my $VECTOR_JUMP = 2;
+my $EXTRA = 4;
+
+my %cycles = (
+	(map { $_ => 2 } qw(adiw sbiw ld ldd st std lds sts push pop sbi cbi
+		rjmp ijmp mul muls mulsu fmul fmuls fmulsu)),
+	(map { $_ => 3 } qw(rcall icall lpm elpm jmp)),
+	(map { $_ => 4 } qw(ret reti call)),
+);
+
+# Instructions which do not write their first operand
+
+my %no_write = map { $_ => 1 } qw(cp cpc cpi cpse sbrc sbrs sbic sbis out
+	st std sts push sbi cbi bst nop sei cli sleep wdr break ret reti);
+
+my @insn;       # { addr, size, op, args, target, func }
+my %at;         # address -> index into @insn
+my %func_start; # function name -> address
+my %func_end;   # function name -> address after its last instruction
+my %is_target;  # addresses jumped or branched to
+
+read_disassembly();
+
+my %isr;        # vector number -> { name, func, entry, state info }
+
+foreach my $func (keys %func_start) {
+	next unless $func =~ /^__vector_(\d+)$/;
+	my $vec = $1;
+	next unless exists $at{$func_start{$func}};
+
+	$isr{$vec} = {
+		vec => $vec,
+		func => $func,
+		name => $vector_names{$vec} || $func,
+		entry => $at{$func_start{$func}},
+	};
+}
+
+foreach my $vec ($VEC_INT0, $VEC_COMPA, $VEC_COMPB) {
+	die "$elf: no $vector_names{$vec} handler; is fd-serial linked in?\n"
+		unless $isr{$vec};
+}
+
+my %memo;
+my %on_path;
+my %loops;
+my %warned;
+my $current;    # ISR whose state constraint applies, or undef
+
+foreach my $vec (sort { $a <=> $b } keys %isr) {
+	find_state($isr{$vec});
+	measure_isr($isr{$vec});
+}
+
+my @cli = find_cli_sections();
+my $main_cli = 0;
+foreach my $c (@cli) {
+	$main_cli = $c->{cycles} if $c->{cycles} > $main_cli;
+}
+
+if ($opts{'s'}) {
+	summary();
+} else {
+	report();
+}
+
+exit(0);
+
+sub usage {
+	die "Usage: isr-timing.pl [-c hz] [-d bits] [-e percent] [-l percent] [-o objdump] [-r rate] [-s] [-v] file.elf\n";
+}
+
+# ------------------------------------------------------------------------
+#  Disassembly
+# ------------------------------------------------------------------------
+
+sub read_disassembly {
+	my $func;
+
+	open(my $fh, '-|', $objdump, '-d', $elf)
+		or die "Unable to run $objdump: $!\n";
+
+	while (<$fh>) {
+		chomp;
+
+		if (/^([0-9a-f]+) <([^>]+)>:$/) {
+			$func = $2;
+			$func_start{$func} = hex($1);
+			$func_end{$func} = hex($1);
+			next;
+		}
+
+		next unless defined $func;
+		next unless /^\s+([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t(\S+)\s*(.*)$/;
+
+		my ($addr, $bytes, $op, $rest) = (hex($1), $2, $3, $4);
+		my $size = () = $bytes =~ /[0-9a-f]{2}/g;
+		my ($args, $comment) = split(/\s*;\s*/, $rest, 2);
+		my $target;
+
+		if (defined $comment && $comment =~ /^0x([0-9a-f]+)/) {
+			$target = hex($1);
+			$is_target{$target} = 1 if $op =~ /^(br|rjmp|jmp)/;
+		}
+
+		$at{$addr} = scalar @insn;
+		push(@insn, {
+			addr => $addr,
+			size => $size,
+			op => $op,
+			args => [ split(/,\s*/, $args || '') ],
+			comment => $comment || '',
+			target => $target,
+			func => $func,
+		});
+		$func_end{$func} = $addr + $size;
+	}
+
+	close($fh) or die "$objdump failed on $elf\n";
+
+	die "$elf: no instructions found\n" unless @insn;
+}
+
+sub next_index {
+	my $i = shift;
+	my $n = $insn[$i];
+
+	return $at{$n->{addr} + $n->{size}};
+}
+
+sub target_index {
+	my $i = shift;
+	my $n = $insn[$i];
+
+	if (! defined $n->{target} || ! exists $at{$n->{target}}) {
+		die sprintf("%s: no target for %s at 0x%x\n", $elf, $n->{op}, $n->{addr});
+	}
+
+	return $at{$n->{target}};
+}
+
+sub is_branch {
+	my $op = shift;
+	return $op =~ /^br/ && $op ne 'break';
+}
+
+sub is_skip {
+	my $op = shift;
+	return $op =~ /^(sbrc|sbrs|sbic|sbis|cpse)$/;
+}
+
+sub is_call {
+	my $op = shift;
+	return $op =~ /^(rcall|call)$/;
+}
+
+sub insn_cycles {
+	my $op = shift;
+	return $cycles{$op} || 1;
+}
+
+sub where {
+	my $i = shift;
+	return sprintf("0x%x <%s>", $insn[$i]{addr}, $insn[$i]{func});
+}
+
+# ------------------------------------------------------------------------
+#  Control flow
+# ------------------------------------------------------------------------
+
+#  Return the ways out of instruction i, as [ index, cycles, taken ].
+#  A call costs its own cycles plus the longest path through the
+#  function called.
+
+sub successors {
+	my $i = shift;
+	my $n = $insn[$i];
+	my $op = $n->{op};
+
+	return () if $op eq 'ret' || $op eq 'reti';
+
+	if ($op eq 'rjmp' || $op eq 'jmp') {
+		return [ target_index($i), insn_cycles($op), 1 ];
+	}
+
+	if (is_branch($op)) {
+		return (
+			[ next_index($i), 1, 0 ],
+			[ target_index($i), 2, 1 ],
+		);
+	}
+
+	if (is_skip($op)) {
+		my $next = next_index($i);
+		my $after = next_index($next);
+		return (
+			[ $next, 1, 0 ],
+			[ $after, 1 + $insn[$next]{size} / 2, 1 ],
+		);
+	}
+
+	if (is_call($op)) {
+		my $callee = target_index($i);
+		my $saved = $current;
+		$current = undef;
+		my $c = path($callee, 'ret', 'max');
+		$current = $saved;
+		die sprintf("%s: %s never returns\n", $elf, where($callee)) unless defined $c;
+		return [ next_index($i), insn_cycles($op) + $c, 0 ];
+	}
+
+	if ($op eq 'ijmp' || $op eq 'icall') {
+		# Jump tables and function pointers can go anywhere. Take
+		# the worst case of any instruction in the function.
+		unless ($warned{$i}++) {
+			warn sprintf("%s: %s at %s: assuming the worst of its function\n",
+				$elf, $op, where($i));
+		}
+		my @s;
+		foreach my $j ($at{$func_start{$n->{func}}} .. $i - 1) {
+			push(@s, [ $j, insn_cycles($op), 1 ]);
+		}
+		push(@s, [ next_index($i), insn_cycles($op), 0 ]) if $op eq 'icall';
+		return @s;
+	}
+
+	return [ next_index($i), insn_cycles($op), 0 ];
+}
+
+#  Longest ('max') or shortest ('min') cycles from instruction i to
+#  the end of the path, or undef if no path gets there.
+#
+#  'ret'    Up to and including a ret or reti
+#  'rx'     Up to the PINB read of the rx pin
+#  'tx'     Up to the PORTB write of the tx pin
+#  'tcnt'   Up to the TCNT1 read
+#  'sreg'   Up to and including the restore of SREG, or sei
+
+sub path {
+	my ($i, $mode, $which) = @_;
+	my $k = defined $current ? "$current->{vec}:$current->{k}" : '*';
+	my $key = "$i,$mode,$which,$k";
+
+	return $memo{$key} if exists $memo{$key};
+
+	my $n = $insn[$i];
+
+	if ($mode eq 'ret' && ($n->{op} eq 'ret' || $n->{op} eq 'reti')) {
+		return $memo{$key} = insn_cycles($n->{op});
+	}
+	if ($mode eq 'sreg' && is_sreg_restore($n)) {
+		return $memo{$key} = insn_cycles($n->{op});
+	}
+	if ($mode eq 'sreg' && $n->{op} eq 'ret') {
+		return $memo{$key} = undef;
+	}
+	if (is_io($n, $mode)) {
+		return $memo{$key} = 1;
+	}
+
+	if ($on_path{$key}) {
+		# A loop: count it once
+		$loops{$i} = 1;
+		return undef;
+	}
+
+	$on_path{$key} = 1;
+
+	my $best;
+
+	foreach my $s (successors($i)) {
+		my ($j, $c, $taken) = @$s;
+		next unless defined $j;
+		next unless feasible($i, $taken);
+
+		my $rest = path($j, $mode, $which);
+		next unless defined $rest;
+
+		my $v = $c + $rest;
+		if (! defined $best || ($which eq 'max' ? $v > $best : $v < $best)) {
+			$best = $v;
+		}
+	}
+
+	delete $on_path{$key};
+
+	return $memo{$key} = $best;
+}
+
+sub is_io {
+	my ($n, $mode) = @_;
+	my $op = $n->{op};
+	my @a = @{$n->{args}};
+
+	return 0 unless @a;
+
+	if ($mode eq 'tcnt') {
+		return $op eq 'in' && hex($a[1]) == $IO_TCNT1;
+	}
+
+	if ($mode eq 'rx') {
+		return ($op eq 'in' && hex($a[1]) == $IO_PINB)
+			|| ($op =~ /^sbi[cs]$/ && hex($a[0]) == $IO_PINB && $a[1] == $RX_BIT);
+	}
+
+	if ($mode eq 'tx') {
+		return ($op eq 'out' && hex($a[0]) == $IO_PORTB)
+			|| ($op =~ /^[cs]bi$/ && hex($a[0]) == $IO_PORTB && $a[1] == $TX_BIT);
+	}
+
+	return 0;
+}
+
+sub is_sreg_restore {
+	my $n = shift;
+
+	return 1 if $n->{op} eq 'sei';
+	return $n->{op} eq 'out' && hex($n->{args}[0]) == $IO_SREG;
+}
+
+# ------------------------------------------------------------------------
+#  State variables
+# ------------------------------------------------------------------------
+
+#  Find the variable the ISR switches on: the lds whose register is
+#  compared with the most different constants before it is changed.
+
+sub find_state {
+	my $isr = shift;
+	my $func = $isr->{func};
+	my $first = $isr->{entry};
+	my $last = $first;
+	my $best_count = 1;
+
+	$last ++ while $last < $#insn && $insn[$last + 1]{func} eq $func;
+
+	foreach my $i ($first .. $last) {
+		my $n = $insn[$i];
+		next unless $n->{op} eq 'lds' || is_gpior_read($n);
+		my $reg = $n->{args}[0];
+		my %values;
+
+		foreach my $j ($i + 1 .. $last) {
+			my $m = $insn[$j];
+			if ($m->{op} eq 'cpi' && $m->{args}[0] eq $reg) {
+				$values{hex($m->{args}[1])} = 1;
+			} elsif (writes_reg($m, $reg)) {
+				last;
+			}
+		}
+
+		if (keys %values > $best_count) {
+			$best_count = keys %values;
+			$isr->{state_lds} = $i;
+			$isr->{state_reg} = $reg;
+			$isr->{state_var} = $n->{comment} =~ /<([^>]+)>/ ? $1
+				: is_gpior_read($n) ? 'GPIOR' . (hex($n->{args}[1]) - $IO_GPIOR0)
+				: $n->{args}[1];
+			my @v = sort { $a <=> $b } keys %values;
+			$isr->{states} = [ 0 .. $v[-1] ];
+		}
+	}
+
+	return unless defined $isr->{state_reg};
+
+	# The register holds the state at instructions reached from the
+	# lds without passing a write to it, and not reached any other way.
+
+	my (%from_lds, %tainted, @todo);
+
+	@todo = map { $_->[0] } successors_plain($isr->{state_lds});
+	while (defined(my $j = shift @todo)) {
+		next if $from_lds{$j}++;
+		next unless in_func($j, $func);
+		next if writes_reg($insn[$j], $isr->{state_reg});
+		push(@todo, map { $_->[0] } successors_plain($j));
+	}
+
+	@todo = ($isr->{entry});
+	foreach my $j (keys %from_lds) {
+		push(@todo, map { $_->[0] } successors_plain($j))
+			if writes_reg($insn[$j], $isr->{state_reg});
+	}
+	while (defined(my $j = shift @todo)) {
+		next if $j == $isr->{state_lds};
+		next if $tainted{$j}++;
+		next unless in_func($j, $func);
+		push(@todo, map { $_->[0] } successors_plain($j));
+	}
+
+	$isr->{valid} = { map { $_ => 1 } grep { ! $tainted{$_} } keys %from_lds };
+}
+
+#  FD_COMPACT keeps the state bytes in GPIOR0-2
+
+sub is_gpior_read {
+	my $n = shift;
+
+	return 0 unless $n->{op} eq 'in';
+	my $io = hex($n->{args}[1]);
+	return $io >= $IO_GPIOR0 && $io <= $IO_GPIOR0 + 2;
+}
+
+#  Successors without costing calls, for reachability
+
+sub successors_plain {
+	my $i = shift;
+	my $op = $insn[$i]{op};
+
+	return () if $op eq 'ret' || $op eq 'reti' || $op eq 'ijmp';
+	return [ target_index($i) ] if $op eq 'rjmp' || $op eq 'jmp';
+	return ([ next_index($i) ], [ target_index($i) ]) if is_branch($op);
+	return ([ next_index($i) ], [ next_index(next_index($i)) ]) if is_skip($op);
+	return [ next_index($i) ];
+}
+
+sub in_func {
+	my ($i, $func) = @_;
+	return defined $i && $insn[$i]{func} eq $func;
+}
+
+sub writes_reg {
+	my ($n, $reg) = @_;
+	my $op = $n->{op};
+	my @a = @{$n->{args}};
+
+	return 1 if is_call($op) || $op eq 'icall';
+	return 0 if $no_write{$op} || is_branch($op) || ! @a;
+	return 0 if $op eq 'and' && @a == 2 && $a[0] eq $a[1];
+
+	if ($op =~ /^(movw|adiw|sbiw)$/) {
+		my ($r) = $a[0] =~ /^r(\d+)$/;
+		return $reg eq "r$r" || $reg eq 'r' . ($r + 1);
+	}
+
+	return $a[0] eq $reg || ($op =~ /^mul/ && $reg =~ /^r[01]$/);
+}
+
+#  Can the branch or skip at i go the way given by taken, when the
+#  current ISR's state variable has the current value?
+
+sub feasible {
+	my ($i, $taken) = @_;
+
+	return 1 unless defined $current && $current->{valid};
+
+	my $n = $insn[$i];
+	my $op = $n->{op};
+	my $reg = $current->{state_reg};
+	my $k = $current->{k};
+
+	if ($op =~ /^sbr[cs]$/) {
+		return 1 unless $current->{valid}{$i} && $n->{args}[0] eq $reg;
+		my $set = ($k >> $n->{args}[1]) & 1;
+		my $skip = $op eq 'sbrs' ? $set : ! $set;
+		return $taken ? $skip : ! $skip;
+	}
+
+	return 1 unless is_branch($op);
+
+	# Flags come from the last instruction before the branches, as
+	# long as nothing jumps in between
+	my $j = $i;
+	while ($j == $i || is_branch($insn[$j]{op})) {
+		return 1 if $is_target{$insn[$j]{addr}};
+		$j --;
+		return 1 if $j < 0;
+	}
+	return 1 unless $current->{valid}{$j};
+
+	my $m = $insn[$j];
+	my @a = @{$m->{args}};
+	my $c;
+
+	if ($m->{op} eq 'cpi' && $a[0] eq $reg) {
+		$c = hex($a[1]);
+	} elsif ($m->{op} eq 'and' && $a[0] eq $reg && $a[1] eq $reg) {
+		$c = 0;
+	} elsif ($m->{op} eq 'cp' && $a[0] eq $reg && $a[1] eq 'r1') {
+		$c = 0;
+	} else {
+		return 1;
+	}
+
+	my $sk = $k > 127 ? $k - 256 : $k;
+	my $sc = $c > 127 ? $c - 256 : $c;
+	my %cond = (
+		breq => $k == $c, brne => $k != $c,
+		brlo => $k < $c, brcs => $k < $c,
+		brsh => $k >= $c, brcc => $k >= $c,
+		brlt => $sk < $sc, brge => $sk >= $sc,
+	);
+
+	return 1 unless exists $cond{$op};
+	return $taken ? $cond{$op} : ! $cond{$op};
+}
+
+# ------------------------------------------------------------------------
+#  Measurement
+# ------------------------------------------------------------------------
+
+sub measure_isr {
+	my $isr = shift;
+	my $e = $isr->{entry};
+	my $io = $isr->{vec} == $VEC_INT0 ? 'tcnt'
+		: $isr->{vec} == $VEC_COMPA ? 'tx'
+		: $isr->{vec} == $VEC_COMPB ? 'rx' : undef;
+
+	%loops = ();
+	$current = undef;
+	$isr->{max} = path($e, 'ret', 'max');
+	$isr->{min} = path($e, 'ret', 'min');
+	die "$elf: $isr->{name} never returns\n" unless defined $isr->{max};
+
+	if (defined $io) {
+		$isr->{io_max} = path($e, $io, 'max');
+		$isr->{io_min} = path($e, $io, 'min');
+		die "$elf: $isr->{name} does not touch its pin\n" unless defined $isr->{io_max};
+	}
+
+	$isr->{per_state} = [];
+
+	if ($isr->{states}) {
+		foreach my $k (@{$isr->{states}}) {
+			$isr->{k} = $k;
+			$current = $isr;
+			my %s = (
+				state => $k,
+				max => path($e, 'ret', 'max'),
+				min => path($e, 'ret', 'min'),
+			);
+			if (defined $io) {
+				$s{io_max} = path($e, $io, 'max');
+				$s{io_min} = path($e, $io, 'min');
+			}
+			$current = undef;
+			push(@{$isr->{per_state}}, \%s) if defined $s{max};
+		}
+	}
+
+	$isr->{loops} = [ sort { $a <=> $b } keys %loops ];
+}
+
+#  Longest stretch with interrupts off outside the ISRs, from each
+#  cli to the instruction which turns them back on.
+
+sub find_cli_sections {
+	my @found;
+
+	%loops = ();
+	$current = undef;
+
+	foreach my $i (0 .. $#insn) {
+		next unless $insn[$i]{op} eq 'cli';
+		next if $insn[$i]{func} =~ /^__vector_/;
+
+		my $next = next_index($i);
+		next unless defined $next;
+		my $c = path($next, 'sreg', 'max');
+		next unless defined $c;
+
+		push(@found, {
+			where => where($i),
+			cycles => 1 + $c,
+		});
+	}
+
+	return @found;
+}
+
+# ------------------------------------------------------------------------
+#  Schedulability
+# ------------------------------------------------------------------------
+
+sub busy {
+	my $isr = shift;
+	return $RESPONSE + $VECTOR_JUMP + $isr->{max};
+}
+
+#  Work out the worst case at one bit time (in CPU cycles), for the
+#  timer settings which give it, and a far end running at rate.
+
+sub analyse {
+	my ($prescale, $top, $rate) = @_;
+	my $bit = $prescale * ($top + 1);
+	my $half = int(($top + 1) / 2) * $prescale;
+	my ($int0, $compa, $compb) = map { $isr{$_} } ($VEC_INT0, $VEC_COMPA, $VEC_COMPB);
+	my $others = $main_cli;
+
+	foreach my $vec (keys %isr) {
+		next if $vec == $VEC_INT0 || $vec == $VEC_COMPA || $vec == $VEC_COMPB;
+		$others = busy($isr{$vec}) if busy($isr{$vec}) > $others;
+	}
+
+	my $enter = $RESPONSE + $VECTOR_JUMP;
+
+	# Start edge to TCNT1 read
+	my $block_int0 = max(busy($compa), busy($compb), $others) + $EXTRA;
+	my $int0_max = $block_int0 + $enter + $int0->{io_max};
+	my $int0_min = $enter + $int0->{io_min};
+	my $int0_done = $block_int0 + $enter + $int0->{max};
+
+	# Compare match to PINB read
+	my $block_compb = $others + $EXTRA + busy($compa) + $EXTRA;
+	my $compb_max = $block_compb + $enter + $compb->{io_max};
+	my $compb_min = $enter + $compb->{io_min};
+	my $compb_done = $block_compb + $enter + $compb->{max};
+
+	# Compare match to PORTB write
+	my $block_compa = max(busy($compb), $others) + $EXTRA + busy($int0) + $EXTRA;
+	my $compa_max = $block_compa + $enter + $compa->{io_max};
+	my $compa_min = $enter + $compa->{io_min};
+	my $compa_done = $block_compa + $enter + $compa->{max};
+
+	# The TCNT1 read can be up to one timer tick late
+	my $base_max = $int0_max + $half + $compb_max;
+	my $base_min = $int0_min - ($prescale - 1) + $half + $compb_min;
+
+	my $last = $data_bits + 1;
+	my ($rx, $tx) = (0, $compa_max - $compa_min);
+	my $drift = 0;
+
+	foreach my $far ($rate * (1 - $clock_error), $rate * (1 + $clock_error)) {
+		my $far_bit = $cpu_freq / $far;
+
+		foreach my $n (0, $last) {
+			foreach my $base ($base_max, $base_min) {
+				my $off = abs($base + $n * $bit - ($n + 0.5) * $far_bit);
+				$rx = $off if $off > $rx;
+			}
+			my $d = abs($n * ($bit - $far_bit));
+			$drift = $d if $d > $drift;
+		}
+	}
+
+	$tx += $drift;
+
+	my $nominal = $cpu_freq / $rate;
+	my $safe = $rx <= $limit * $nominal
+		&& $tx <= $limit * $nominal
+		&& $int0_done <= $half
+		&& $compa_done <= $bit
+		&& $compb_done <= $bit;
+
+	return {
+		bit => $bit,
+		rx => $rx,
+		tx => $tx,
+		rx_pct => 100 * $rx / $nominal,
+		tx_pct => 100 * $tx / $nominal,
+		busy => max($int0_done / $half, $compa_done / $bit, $compb_done / $bit) * 100,
+		safe => $safe,
+	};
+}
+
+#  Timer1 settings nearest to rate: the smallest power of two
+#  prescaler which lets TOP fit in 8 bits, as fd-serial would use.
+
+sub timer_for {
+	my $rate = shift;
+
+	for (my $prescale = 1; $prescale <= 16384; $prescale *= 2) {
+		my $ticks = int($cpu_freq / ($prescale * $rate) + 0.5);
+		return ($prescale, $ticks - 1) if $ticks <= 256 && $ticks >= 2;
+	}
+
+	return;
+}
+
+sub max {
+	my $m = shift;
+	foreach (@_) {
+		$m = $_ if $_ > $m;
+	}
+	return $m;
+}
+
+# ------------------------------------------------------------------------
+#  Report
+# ------------------------------------------------------------------------
+
+sub range {
+	my ($lo, $hi) = @_;
+	return '-' unless defined $hi;
+	return $lo == $hi ? "$hi" : "$lo-$hi";
+}
+
+sub report {
+	printf("%s: %d Hz, %d data bits, limit %d%% of a bit\n\n",
+		$elf, $cpu_freq, $data_bits, $limit * 100);
+
+	print "Cycles from the vector, not counting the $RESPONSE cycle response\n";
+	print "and $VECTOR_JUMP cycle vector jump:\n\n";
+	printf("  %-16s %-14s %8s %10s\n", 'ISR', 'state', 'pin', 'reti');
+
+	foreach my $vec (sort { $a <=> $b } keys %isr) {
+		my $isr = $isr{$vec};
+		my $loop = @{$isr->{loops}} ? ' (loop, lower bound)' : '';
+
+		printf("  %-16s %-14s %8s %10s%s\n", $isr->{name}, 'any',
+			range($isr->{io_min}, $isr->{io_max}),
+			range($isr->{min}, $isr->{max}), $loop);
+
+		if (@{$isr->{per_state}}) {
+			printf("  %-16s %s\n", '', "switch on $isr->{state_var}");
+		}
+
+		foreach my $s (@{$isr->{per_state}}) {
+			printf("  %-16s %-14s %8s %10s\n", '', $s->{state},
+				range($s->{io_min}, $s->{io_max}),
+				range($s->{min}, $s->{max}));
+		}
+
+		foreach my $i (@{$isr->{loops}}) {
+			printf("  %-16s loop at %s counted once\n", '', where($i));
+		}
+	}
+
+	printf("\nLongest cli() section: %d cycles\n", $main_cli);
+
+	if ($opts{'v'}) {
+		foreach my $c (sort { $b->{cycles} <=> $a->{cycles} } @cli) {
+			printf("  %5d  %s\n", $c->{cycles}, $c->{where});
+		}
+	}
+
+	print "\nWorst case with INT0, COMPA and COMPB pending in the same bit:\n\n";
+	printf("  %7s %8s %5s %6s %14s %14s %6s\n",
+		'rate', 'timer', 'bit', 'error', 'rx sample', 'tx edge', 'busy');
+
+	my ($built_ok, $max_rate);
+
+	foreach my $rate (@standard_rates) {
+		my ($prescale, $top) = timer_for($rate);
+		next unless defined $prescale;
+
+		my $r = analyse($prescale, $top, $rate);
+		my $error = 100 * ($cpu_freq / $r->{bit} - $rate) / $rate;
+
+		printf("  %7d %8s %5d %5.1f%% %5d %6.1f%% %5d %6.1f%% %5.0f%% %s\n",
+			$rate, "/$prescale $top", $r->{bit}, $error,
+			$r->{rx}, $r->{rx_pct}, $r->{tx}, $r->{tx_pct}, $r->{busy},
+			$r->{safe} ? 'ok' : 'UNSAFE');
+
+		$max_rate = $rate if $r->{safe};
+		$built_ok = $r->{safe} if defined $opts{'r'} && $rate == $opts{'r'};
+	}
+
+	# The fastest bit time which is safe, over every timer setting,
+	# with the far end at exactly the same rate
+
+	my $fastest;
+
+	for (my $prescale = 1; $prescale <= 16384; $prescale *= 2) {
+		foreach my $top (1 .. 255) {
+			my $bit = $prescale * ($top + 1);
+			next if defined $fastest && $bit >= $fastest;
+			my $r = analyse($prescale, $top, $cpu_freq / $bit);
+			if ($r->{safe}) {
+				$fastest = $bit;
+				last;
+			}
+		}
+	}
+
+	print "\n";
+	if (defined $max_rate) {
+		print "Maximum safe full-duplex rate: $max_rate bps\n";
+	} else {
+		print "No standard rate is safe\n";
+	}
+	if (defined $fastest) {
+		printf("Shortest safe bit time: %d cycles (%d bps)\n",
+			$fastest, $cpu_freq / $fastest);
+	}
+
+	if (defined $opts{'r'}) {
+		$built_ok = rate_safe($opts{'r'}) unless defined $built_ok;
+		if (! $built_ok) {
+			print "$opts{'r'} bps is NOT safe\n";
+			exit(1);
+		}
+	}
+}
+
+sub rate_safe {
+	my $rate = shift;
+	my ($prescale, $top) = timer_for($rate);
+
+	die "$rate bps cannot be made with Timer1\n" unless defined $prescale;
+	return analyse($prescale, $top, $rate)->{safe};
+}
+
+#  One line, for the table of library variants
+
+sub summary {
+	my $max_rate = '-';
+
+	foreach my $rate (@standard_rates) {
+		next unless defined timer_for($rate);
+		$max_rate = $rate if rate_safe($rate);
+	}
+
+	my @line = map { $isr{$_}{max} } ($VEC_INT0, $VEC_COMPA, $VEC_COMPB);
+	push(@line, $max_rate);
+	push(@line, rate_safe($opts{'r'}) ? 'ok' : 'UNSAFE') if defined $opts{'r'};
+
+	print join(' ', @line), "\n";
+}
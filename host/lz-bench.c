@@ -0,0 +1,120 @@
+/*
+**  Tullnet LZ compression benchmark
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Builds lz.c on the host, compresses each file given (recorded
+**  serial logs), checks that host/lz-decode.c gives back the same
+**  bytes, and prints the compression ratio. With -f, lz_flush() is
+**  called after every newline, as serial-fmt does.
+**
+**  Usage: lz-bench [-f] file ...
+**
+**  The exit status is non-zero if any file does not round-trip.
+**  For cycles per byte on the ATtiny, see 'make lz-bench'.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz.h"
+
+#define LZ_NO_MAIN
+#include "lz-decode.c"
+
+static unsigned char *packed;
+static size_t packed_len, packed_size;
+
+void lz_out(unsigned char c) {
+	if (packed_len == packed_size) {
+		packed_size = packed_size ? packed_size * 2 : 65536;
+		if (! (packed = realloc(packed, packed_size))) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+	packed[packed_len++] = c;
+}
+
+static unsigned char *slurp(const char *name, size_t *len) {
+	FILE *f = fopen(name, "rb");
+	unsigned char *buf = NULL;
+	size_t size = 0;
+	size_t n;
+
+	if (! f) {
+		perror(name);
+		exit(2);
+	}
+
+	*len = 0;
+	do {
+		size += 65536;
+		if (! (buf = realloc(buf, size))) {
+			perror("realloc");
+			exit(2);
+		}
+		n = fread(buf + *len, 1, size - *len, f);
+		*len += n;
+	} while (*len == size);
+
+	fclose(f);
+	return buf;
+}
+
+int main(int argc, char *argv[]) {
+	int flush_lines = 0;
+	int fails = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f")) != -1) {
+		if (opt == 'f') {
+			flush_lines = 1;
+		} else {
+			fprintf(stderr, "Usage: lz-bench [-f] file ...\n");
+			return 2;
+		}
+	}
+
+	printf("%-24s %8s %8s %6s\n", "log", "bytes", "packed", "ratio");
+
+	for (int i = optind; i < argc; ++i) {
+		size_t len;
+		unsigned char *buf = slurp(argv[i], &len);
+
+		packed_len = 0;
+		lz_reset();
+		for (size_t j = 0; j < len; ++j) {
+			lz_char(buf[j]);
+			if (flush_lines && buf[j] == '\n') {
+				lz_flush();
+			}
+		}
+		lz_flush();
+
+		struct lz_state s;
+		char *unpacked;
+		size_t unpacked_len;
+		FILE *in = fmemopen(packed, packed_len ? packed_len : 1, "rb");
+		FILE *out = open_memstream(&unpacked, &unpacked_len);
+
+		if (! packed_len) {
+			getc(in);
+		}
+		lz_init(&s);
+		int rc = lz_decode(in, out, &s);
+		fclose(in);
+		fclose(out);
+
+		int ok = ! rc && unpacked_len == len && ! memcmp(unpacked, buf, len);
+
+		printf("%-24s %8zu %8zu %5.2fx%s\n", argv[i], len, packed_len,
+			packed_len ? (double) len / packed_len : 0.0, ok ? "" : "  FAIL: round trip");
+		fails += ! ok;
+		free(unpacked);
+		free(buf);
+	}
+
+	return fails != 0;
+}
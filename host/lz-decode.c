@@ -0,0 +1,90 @@
+/*
+**  Tullnet streaming LZ decompressor
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Decompresses the output of lz.c (see lz.h for the format) from
+**  a file or stdin to stdout.
+**
+**  Usage: lz-decode [file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "lz.h"
+
+struct lz_state {
+	unsigned char window[LZ_WINDOW];
+	unsigned pos;
+};
+
+static void lz_init(struct lz_state *s) {
+	for (int i = 0; i < LZ_WINDOW; ++i) {
+		s->window[i] = 0;
+	}
+	s->pos = 0;
+}
+
+static void lz_emit(struct lz_state *s, unsigned char c, FILE *out) {
+	s->window[s->pos++ % LZ_WINDOW] = c;
+	putc(c, out);
+}
+
+/*
+**  Decompress in to out. Return 0, or -1 if the input ends in the
+**  middle of a code.
+*/
+
+static int lz_decode(FILE *in, FILE *out, struct lz_state *s) {
+	int c;
+
+	while ((c = getc(in)) != EOF) {
+		if (c < LZ_REPEAT) {
+			lz_emit(s, c, out);
+		} else if (c == LZ_ESCAPE) {
+			if ((c = getc(in)) == EOF) {
+				return -1;
+			}
+			lz_emit(s, c, out);
+		} else {
+			int len = (c & 0x0f) + LZ_MIN;
+			int d = getc(in);
+
+			if (d == EOF) {
+				return -1;
+			}
+			d = (d & (LZ_WINDOW - 1)) + 1;
+			while (len--) {
+				lz_emit(s, s->window[(s->pos - d) % LZ_WINDOW], out);
+			}
+		}
+	}
+
+	return 0;
+}
+
+#ifndef LZ_NO_MAIN
+
+int main(int argc, char *argv[]) {
+	struct lz_state s;
+	FILE *in = stdin;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: lz-decode [file]\n");
+		return 2;
+	}
+	if (argc == 2 && ! (in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 2;
+	}
+
+	lz_init(&s);
+	if (lz_decode(in, stdout, &s)) {
+		fprintf(stderr, "lz-decode: input ends in the middle of a repeat\n");
+		return 1;
+	}
+	return 0;
+}
+
+#endif
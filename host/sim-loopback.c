@@ -0,0 +1,742 @@
+/*
+**  Tullnet fd-serial regression test under simavr
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Runs an example firmware on a simulated ATtiny85 at 8 MHz and
+**  either wires TX (PB3) back to RX (PB2) or plays a host at the
+**  other end of the line. Every edge on PB3 is timed against the
+**  ideal bit boundaries, and the exit status is non-zero if bytes
+**  are dropped or corrupted, or if the jitter exceeds the limit.
+**
+**  Modes:
+**
+**    -m echo    Wait for the text given with -w, then stream -n
+**               pseudo-random bytes (1-255) at the firmware while it
+**               sends, and check they all come back in order.
+**    -m expect  Check the text given with -w is sent -c times.
+**    -m loop    Wire TX to RX. After the text given with -w, -n bytes
+**               must be received which repeat what came round first,
+**               as happens when an echo firmware hears itself.
+**    -m pty     Connect the line to a pseudo-terminal, whose name is
+**               printed, and run in real time until the program which
+**               opened it closes it. For host/fd-upload against
+**               fd-boot, or a terminal program. -w is not needed.
+**
+**  Other options:
+**
+**    -f file    Firmware ELF (required)
+**    -o         Print what the firmware sent, after the run
+**    -r file    Write what the firmware sent to a file
+**    -b         Report how long PB4 was high in total, for firmware
+**               which raises it around the code being timed
+**    -v file    Write a VCD trace of PB2 and PB3
+**    -j cycles  Largest allowed edge jitter (default 1/8 bit)
+**    -p cycles  Firmware bit time in CPU cycles (default 832)
+**    -t ms      Simulated time limit (default 5000, none with -m pty)
+**    -B rate    Host bit rate (default 9600)
+**    -y link    With -m pty, make link a symlink to the pty
+**    -s seed    Seed for the pseudo-random data
+*/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <time.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_core.h"
+#include "sim_cycle_timers.h"
+#include "sim_vcd_file.h"
+#include "avr_ioport.h"
+
+#define CPU_FREQ  8000000
+
+#define MODE_ECHO   1
+#define MODE_EXPECT 2
+#define MODE_LOOP   3
+#define MODE_PTY    4
+
+static avr_t *avr;
+static avr_irq_t *rx_irq;             // PB2, driven by us
+static int mode = MODE_ECHO;
+static int finished;
+static int failed;
+
+static const char *want = "";          // -w text
+static int want_count = 2;             // -c
+static long stream_len = 2000;         // -n
+static uint32_t seed = 1;              // -s
+static long jitter_limit = -1;         // -j, -1 = fw_bit / 8
+static long fw_bit = -1;               // -p, -1 = as fd-serial at host_rate
+static long host_rate = 9600;          // -B
+static int print_rx;                   // -o
+static const char *rx_file;            // -r
+
+/* PB4 marker timing (-b) */
+
+static int mark_timing;
+static int mark_level;
+static avr_cycle_count_t mark_rise;
+static avr_cycle_count_t mark_cycles;
+static long mark_pulses;
+
+/* Received from the firmware */
+
+static unsigned char *rx_data;
+static long rx_len;
+static long rx_size;
+static long echo_at = -1;              // rx_len just after the -w text
+
+/* Sent by the host */
+
+static unsigned char *tx_data;
+static long tx_len;
+static long tx_size;
+static int host_tx_running;
+
+/* Pseudo-terminal (-m pty) */
+
+static int pty_fd = -1;
+static const char *pty_link;           // -y
+static int pty_open;                   // The other end has been opened
+static long pty_sent;                  // Bytes of rx_data written to it
+
+/* PB3 decoder state */
+
+static int tx_level = 1;
+static int dec_bit = -1;               // -1 = idle, 0 = start, 1-8 data, 9 stop
+static unsigned dec_byte;
+static avr_cycle_count_t dec_start;
+static long framing_errors;
+
+/* Jitter statistics */
+
+static avr_cycle_count_t grid_ref;     // Edge the grid is measured from
+static avr_cycle_count_t frame_end;    // Where the last stop bit ends
+static int have_grid;
+static long edges;
+static long jitter_max;
+static long long jitter_sum;
+static long jitter_hist[8];            // 0-4, 5-9, ... 35+ cycles
+
+/*
+**  Start of bit n at the host's bit rate, in cycles
+*/
+
+static avr_cycle_count_t host_bit(avr_cycle_count_t n) {
+	return n * CPU_FREQ / host_rate;
+}
+
+/*
+**  Bit time in cycles of fd-serial at rate: the smallest Timer1
+**  prescaler which gives 256 ticks or fewer, as in fd-serial.c
+*/
+
+static long fd_bit_cycles(long rate) {
+	for (long div = 1; div <= 256; div *= 2) {
+		long ticks = (CPU_FREQ + div * rate / 2) / (div * rate);
+
+		if (ticks <= 256) {
+			return ticks * div;
+		}
+	}
+	return CPU_FREQ / rate;
+}
+
+/*
+**  xorshift32, so runs are repeatable for a given seed
+*/
+
+static uint32_t prng(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void mark_pin(struct avr_irq_t *irq, uint32_t value, void *param) {
+	int level = value ? 1 : 0;
+
+	if (level == mark_level) {
+		return;
+	}
+	mark_level = level;
+
+	if (level) {
+		mark_rise = avr->cycle;
+	} else {
+		mark_cycles += avr->cycle - mark_rise;
+		mark_pulses ++;
+	}
+}
+
+static void rx_store(unsigned char c) {
+	if (rx_len == rx_size) {
+		rx_size = rx_size ? rx_size * 2 : 4096;
+		rx_data = realloc(rx_data, rx_size);
+		if (! rx_data) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+	rx_data[rx_len++] = c;
+}
+
+/*
+**  Sample PB3 in the middle of each bit of a byte
+*/
+
+static avr_cycle_count_t dec_sample(avr_t *avr, avr_cycle_count_t when, void *param) {
+	if (dec_bit < 0) {
+		return 0;
+	}
+
+	if (dec_bit == 0) {
+		if (tx_level) {
+			// Glitch, not a start bit
+			dec_bit = -1;
+			return 0;
+		}
+		dec_byte = 0;
+	} else if (dec_bit <= 8) {
+		dec_byte |= (tx_level ? 1u : 0u) << (dec_bit - 1);
+	} else {
+		if (! tx_level) {
+			framing_errors ++;
+		}
+		rx_store(dec_byte);
+		dec_bit = -1;
+		return 0;
+	}
+
+	dec_bit ++;
+	return dec_start + host_bit(dec_bit) + host_bit(1) / 2;
+}
+
+/*
+**  Measure an edge against the firmware's bit grid
+*/
+
+static void edge_jitter(avr_cycle_count_t now) {
+	long long d = now - grid_ref;
+	long long n = (d + fw_bit / 2) / fw_bit;
+	long dev = labs((long) (d - n * fw_bit));
+
+	edges ++;
+	jitter_sum += dev;
+	if (dev > jitter_max) {
+		jitter_max = dev;
+	}
+	jitter_hist[dev / 5 < 7 ? dev / 5 : 7] ++;
+}
+
+/*
+**  PB3 changed
+*/
+
+static void tx_pin(struct avr_irq_t *irq, uint32_t value, void *param) {
+	int level = value ? 1 : 0;
+
+	if (level == tx_level) {
+		return;
+	}
+	tx_level = level;
+
+	if (mode == MODE_LOOP) {
+		avr_raise_irq(rx_irq, level);
+	}
+
+	avr_cycle_count_t now = avr->cycle;
+	int start = ! level && dec_bit < 0;
+
+	// A start bit which does not follow straight on from a stop bit
+	// means the transmitter went idle, and its timing starts again.
+	if (start && (! have_grid || now > frame_end + fw_bit / 2)) {
+		grid_ref = now;
+		have_grid = 1;
+	} else {
+		edge_jitter(now);
+	}
+
+	if (start) {
+		dec_bit = 0;
+		dec_start = now;
+		frame_end = now + fw_bit * 10;
+		avr_cycle_timer_register(avr, host_bit(1) / 2, dec_sample, NULL);
+	}
+}
+
+/*
+**  Drive PB2 with the host's data, one bit per call
+*/
+
+static avr_cycle_count_t host_tx_base;
+static avr_cycle_count_t host_tx_bit;
+
+static avr_cycle_count_t host_tx(avr_t *avr, avr_cycle_count_t when, void *param) {
+	long byte = host_tx_bit / 10;
+	int bit = host_tx_bit % 10;
+
+	if (byte >= tx_len) {
+		avr_raise_irq(rx_irq, 1);
+		host_tx_running = 0;
+		return 0;
+	}
+
+	if (bit == 0) {
+		avr_raise_irq(rx_irq, 0);
+	} else if (bit <= 8) {
+		avr_raise_irq(rx_irq, (tx_data[byte] >> (bit - 1)) & 1);
+	} else {
+		avr_raise_irq(rx_irq, 1);
+	}
+
+	host_tx_bit ++;
+	return host_tx_base + host_bit(host_tx_bit);
+}
+
+/*
+**  Start streaming pseudo-random bytes, back to back
+*/
+
+static void host_start(void) {
+	tx_data = malloc(stream_len);
+	if (! tx_data) {
+		perror("malloc");
+		exit(2);
+	}
+
+	for (tx_len = 0; tx_len < stream_len; ++tx_len) {
+		tx_data[tx_len] = prng() % 255 + 1;
+	}
+
+	host_tx_base = avr->cycle;
+	host_tx_bit = 0;
+	host_tx_running = 1;
+	avr_cycle_timer_register(avr, 1, host_tx, NULL);
+}
+
+/*
+**  Create the pseudo-terminal for -m pty, in raw mode
+*/
+
+static void pty_create(void) {
+	struct termios t;
+
+	pty_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (pty_fd < 0 || grantpt(pty_fd) || unlockpt(pty_fd)) {
+		perror("posix_openpt");
+		exit(2);
+	}
+	if (! tcgetattr(pty_fd, &t)) {
+		cfmakeraw(&t);
+		tcsetattr(pty_fd, TCSANOW, &t);
+	}
+
+	const char *name = ptsname(pty_fd);
+
+	if (pty_link) {
+		unlink(pty_link);
+		if (symlink(name, pty_link)) {
+			perror(pty_link);
+			exit(2);
+		}
+	}
+	printf("pty: %s\n", name);
+	fflush(stdout);
+}
+
+/*
+**  Pass bytes between the pty and the line. Bytes from the pty are
+**  sent back to back; those from the firmware are written as they
+**  are decoded. Reading gives EIO while nothing has the other end
+**  open; once something has, that means it has closed it.
+*/
+
+static void pty_service(void) {
+	unsigned char buf[256];
+	ssize_t n = read(pty_fd, buf, sizeof(buf));
+
+	if (n > 0) {
+		pty_open = 1;
+		if (tx_len + n > tx_size) {
+			tx_size = (tx_len + n) * 2;
+			tx_data = realloc(tx_data, tx_size);
+			if (! tx_data) {
+				perror("realloc");
+				exit(2);
+			}
+		}
+		memcpy(tx_data + tx_len, buf, n);
+		tx_len += n;
+		if (! host_tx_running) {
+			// Carry on from the next byte boundary, starting now
+			host_tx_base = avr->cycle - host_bit(host_tx_bit);
+			host_tx_running = 1;
+			avr_cycle_timer_register(avr, 1, host_tx, NULL);
+		}
+	} else if (n < 0 && errno == EIO && pty_open) {
+		finished = 1;
+	}
+
+	if (rx_len > pty_sent) {
+		n = write(pty_fd, rx_data + pty_sent, rx_len - pty_sent);
+		if (n > 0) {
+			pty_sent += n;
+			pty_open = 1;
+		} else if (n < 0 && errno == EIO) {
+			// Nothing has it open yet: drop the output
+			pty_sent = rx_len;
+		}
+	}
+}
+
+/*
+**  Keep simulated time from running ahead of real time
+*/
+
+static void pty_pace(void) {
+	static struct timespec start;
+	struct timespec now;
+
+	if (! start.tv_sec && ! start.tv_nsec) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	double real = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+	double sim = (double) avr->cycle / CPU_FREQ;
+
+	if (sim > real + 0.001) {
+		usleep((sim - real) * 1e6 < 10000 ? (sim - real) * 1e6 : 10000);
+	}
+}
+
+static const unsigned char *find(const unsigned char *p, long len, const char *text) {
+	size_t tl = strlen(text);
+
+	for (long i = 0; i + (long) tl <= len; ++i) {
+		if (! memcmp(p + i, text, tl)) {
+			return p + i;
+		}
+	}
+	return NULL;
+}
+
+/*
+**  See whether the test is complete, and start the host's stream
+*/
+
+static void check_progress(void) {
+	const unsigned char *p;
+	long n = 0;
+
+	if (mode == MODE_PTY) {
+		return;
+	}
+
+	if (mode == MODE_EXPECT) {
+		p = find(rx_data, rx_len, want);
+		while (p) {
+			n ++;
+			p += strlen(want);
+			p = find(p, rx_len - (p - rx_data), want);
+		}
+		if (n >= want_count) {
+			finished = 1;
+		}
+		return;
+	}
+
+	if (echo_at < 0) {
+		p = find(rx_data, rx_len, want);
+		if (p) {
+			echo_at = p + strlen(want) - rx_data;
+			if (mode == MODE_ECHO) {
+				host_start();
+			}
+		}
+	} else if (rx_len - echo_at >= stream_len) {
+		finished = 1;
+	}
+}
+
+static void report_echo(void) {
+	long errors = 0;
+
+	for (long i = 0; i < tx_len; ++i) {
+		if (echo_at + i >= rx_len) {
+			printf("FAIL: %ld of %ld bytes not echoed\n", tx_len - i, tx_len);
+			failed = 1;
+			return;
+		}
+		if (rx_data[echo_at + i] != tx_data[i]) {
+			if (! errors) {
+				printf("FAIL: byte %ld sent %02x echoed %02x\n", i, tx_data[i], rx_data[echo_at + i]);
+			}
+			errors ++;
+		}
+	}
+
+	if (errors) {
+		printf("FAIL: %ld bytes corrupt\n", errors);
+		failed = 1;
+	} else {
+		printf("echo: %ld bytes ok\n", tx_len);
+	}
+}
+
+static void report_loop(void) {
+	long n = rx_len - echo_at;
+	long period = 0;
+
+	if (n < stream_len) {
+		printf("FAIL: only %ld bytes came round\n", n);
+		failed = 1;
+		return;
+	}
+
+	// Find the shortest repeat of the start of the text which
+	// accounts for everything after it
+	for (long p = 1; p <= (long) strlen(want) && ! period; ++p) {
+		long i;
+
+		for (i = 0; i < n; ++i) {
+			if (rx_data[echo_at + i] != (unsigned char) want[i % p]) {
+				break;
+			}
+		}
+		if (i == n) {
+			period = p;
+		}
+	}
+
+	if (! period) {
+		printf("FAIL: data coming round is corrupt\n");
+		failed = 1;
+	} else {
+		printf("loop: %ld bytes ok, %ld circulating\n", n, period);
+	}
+}
+
+static void report(void) {
+	printf("received %ld bytes, %ld framing errors\n", rx_len, framing_errors);
+
+	if (mode == MODE_PTY) {
+		printf("pty: %ld bytes to the firmware\n", tx_len);
+	} else if (mode == MODE_EXPECT) {
+		if (finished) {
+			printf("expect: ok\n");
+		} else {
+			printf("FAIL: text not sent %d times\n", want_count);
+			failed = 1;
+		}
+	} else if (echo_at < 0) {
+		printf("FAIL: text not seen\n");
+		failed = 1;
+	} else if (mode == MODE_ECHO) {
+		report_echo();
+	} else {
+		report_loop();
+	}
+
+	if (framing_errors) {
+		failed = 1;
+	}
+
+	printf("edges %ld, jitter max %ld mean %.1f cycles (limit %ld)\n",
+		edges, jitter_max, edges ? (double) jitter_sum / edges : 0.0, jitter_limit);
+	for (int i = 0; i < 8; ++i) {
+		printf("  %2d%s cycles: %ld\n", i * 5, i < 7 ? "-  " : "+  ", jitter_hist[i]);
+	}
+
+	if (jitter_max > jitter_limit) {
+		printf("FAIL: jitter over limit\n");
+		failed = 1;
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: sim-loopback -f firmware.elf [-m echo|expect|loop|pty] [-w text]\n"
+		"       [-c count] [-n bytes] [-s seed] [-j cycles] [-p cycles] [-t ms] [-v file.vcd]\n"
+		"       [-o] [-r file] [-b] [-B rate] [-y link]\n");
+	exit(2);
+}
+
+/*
+**  Turn \r and \n in the -w text into control characters
+*/
+
+static char *unescape(const char *s) {
+	char *out = strdup(s);
+	char *d = out;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] == 'n') {
+			*d++ = '\n';
+			s += 2;
+		} else if (s[0] == '\\' && s[1] == 'r') {
+			*d++ = '\r';
+			s += 2;
+		} else {
+			*d++ = *s++;
+		}
+	}
+	*d = 0;
+	return out;
+}
+
+int main(int argc, char *argv[]) {
+	const char *firmware = NULL;
+	const char *vcd_file = NULL;
+	long limit_ms = -1;
+	elf_firmware_t f;
+	avr_vcd_t vcd;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bc:f:j:m:n:op:r:s:t:v:w:y:B:")) != -1) {
+		switch (opt) {
+			case 'b': mark_timing = 1; break;
+			case 'c': want_count = atoi(optarg); break;
+			case 'f': firmware = optarg; break;
+			case 'j': jitter_limit = atol(optarg); break;
+			case 'n': stream_len = atol(optarg); break;
+			case 'o': print_rx = 1; break;
+			case 'r': rx_file = optarg; break;
+			case 'p': fw_bit = atol(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0) | 1; break;
+			case 't': limit_ms = atol(optarg); break;
+			case 'y': pty_link = optarg; break;
+			case 'B': host_rate = atol(optarg); break;
+			case 'v': vcd_file = optarg; break;
+			case 'w': want = unescape(optarg); break;
+			case 'm':
+				if (! strcmp(optarg, "echo")) {
+					mode = MODE_ECHO;
+				} else if (! strcmp(optarg, "expect")) {
+					mode = MODE_EXPECT;
+				} else if (! strcmp(optarg, "loop")) {
+					mode = MODE_LOOP;
+				} else if (! strcmp(optarg, "pty")) {
+					mode = MODE_PTY;
+				} else {
+					usage();
+				}
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (! firmware || (! *want && mode != MODE_PTY) || host_rate <= 0) {
+		usage();
+	}
+	if (fw_bit < 0) {
+		fw_bit = fd_bit_cycles(host_rate);
+	}
+	if (limit_ms < 0) {
+		limit_ms = mode == MODE_PTY ? 0 : 5000;
+	}
+	if (jitter_limit < 0) {
+		jitter_limit = fw_bit / 8;
+	}
+
+	memset(&f, 0, sizeof(f));
+	if (elf_read_firmware(firmware, &f)) {
+		fprintf(stderr, "Unable to load %s\n", firmware);
+		return 2;
+	}
+	strcpy(f.mmcu, "attiny85");
+	f.frequency = CPU_FREQ;
+
+	avr = avr_make_mcu_by_name(f.mmcu);
+	if (! avr) {
+		fprintf(stderr, "simavr has no attiny85\n");
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &f);
+
+	rx_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 3), tx_pin, NULL);
+	if (mark_timing) {
+		avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 4), mark_pin, NULL);
+	}
+
+	// Idle line
+	avr_raise_irq(rx_irq, 1);
+
+	if (vcd_file) {
+		avr_vcd_init(avr, vcd_file, &vcd, 1);
+		avr_vcd_add_signal(&vcd, rx_irq, 1, "PB2");
+		avr_vcd_add_signal(&vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 3), 1, "PB3");
+		avr_vcd_start(&vcd);
+	}
+
+	if (mode == MODE_PTY) {
+		pty_create();
+	}
+
+	avr_cycle_count_t limit = (avr_cycle_count_t) limit_ms * (CPU_FREQ / 1000);
+	int state = cpu_Running;
+	unsigned int runs = 0;
+
+	while (! finished && (! limit || avr->cycle < limit) && state != cpu_Done && state != cpu_Crashed) {
+		long before = rx_len;
+
+		state = avr_run(avr);
+		if (rx_len != before) {
+			check_progress();
+		}
+		if (mode == MODE_PTY && ! (++runs & 4095)) {
+			pty_service();
+			pty_pace();
+		}
+	}
+
+	if (pty_link) {
+		unlink(pty_link);
+	}
+
+	if (vcd_file) {
+		avr_vcd_stop(&vcd);
+	}
+
+	if (state == cpu_Crashed) {
+		printf("FAIL: firmware crashed\n");
+		failed = 1;
+	}
+
+	printf("%s: %s after %.1f ms\n", firmware, finished ? "done" : "stopped",
+		avr->cycle * 1000.0 / CPU_FREQ);
+	if (mark_timing) {
+		printf("PB4: high for %llu cycles in %ld pulses\n",
+			(unsigned long long) mark_cycles, mark_pulses);
+	}
+	if (rx_file) {
+		FILE *f = fopen(rx_file, "wb");
+
+		if (! f || fwrite(rx_data, 1, rx_len, f) != (size_t) rx_len || fclose(f)) {
+			perror(rx_file);
+			failed = 1;
+		}
+	}
+	if (print_rx) {
+		fwrite(rx_data, 1, rx_len, stdout);
+		if (rx_len && rx_data[rx_len - 1] != '\n') {
+			putchar('\n');
+		}
+	}
+	report();
+
+	return failed;
+}
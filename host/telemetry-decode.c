@@ -0,0 +1,189 @@
+/*
+**  Tullnet binary telemetry decoder
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Reads records sent by telemetry.c and prints one line per record:
+**  the schema id, then the field values in decimal.
+**
+**  Usage: telemetry-decode -s id:fields [-s id:fields ...] [file]
+**
+**    -s id:fields  Schema id has that many fields (at least one -s)
+**    -k            Print records decoded from a keyframe with a '*'
+**
+**  Input is read from the file, or stdin, which may be a serial port
+**  set to raw mode. Records of an unknown schema cannot be skipped,
+**  so decoding stops there. Delta records before the first keyframe
+**  of their schema are dropped.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TM_SCHEMAS 128
+#define TM_FIELDS  32
+
+#define TM_EOF     0
+#define TM_RECORD  1
+#define TM_SKIPPED 2                   // Delta with no keyframe yet
+#define TM_UNKNOWN 3                   // Schema not given with -s
+#define TM_BAD     4                   // Varint too long
+
+struct tm_schema {
+	int fields;                        // 0 = unknown schema
+	int have_key;
+	uint16_t prev[TM_FIELDS];
+};
+
+static struct tm_schema tm_schemas[TM_SCHEMAS];
+
+/*
+**  Read a varint of up to 16 bits. Return 0 at end of input.
+*/
+
+static int tm_varint(FILE *in, unsigned *n, int *bad) {
+	unsigned v = 0;
+	int shift = 0;
+	int c;
+
+	do {
+		if ((c = getc(in)) == EOF) {
+			return 0;
+		}
+		if (shift > 14) {
+			*bad = 1;
+		}
+		v |= (unsigned) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*n = v & 0xffff;
+	return 1;
+}
+
+static int16_t tm_unzigzag(unsigned n) {
+	return (int16_t) (n & 1 ? ~(n >> 1) : n >> 1);
+}
+
+static void tm_define(int id, int fields) {
+	tm_schemas[id].fields = fields;
+	tm_schemas[id].have_key = 0;
+}
+
+/*
+**  Decode one record into id, values and key.
+*/
+
+static int tm_record(FILE *in, int *id, int16_t *values, int *key) {
+	unsigned n;
+	int bad = 0;
+
+	if (! tm_varint(in, &n, &bad)) {
+		return TM_EOF;
+	}
+	if (bad || n >> 1 >= TM_SCHEMAS) {
+		return TM_BAD;
+	}
+
+	struct tm_schema *s = &tm_schemas[n >> 1];
+	*id = n >> 1;
+	*key = n & 1;
+
+	if (! s->fields) {
+		return TM_UNKNOWN;
+	}
+
+	for (int i = 0; i < s->fields; ++i) {
+		unsigned d;
+
+		if (! tm_varint(in, &d, &bad)) {
+			return TM_EOF;
+		}
+		uint16_t v = tm_unzigzag(d);
+		s->prev[i] = *key ? v : (uint16_t) (s->prev[i] + v);
+		values[i] = (int16_t) s->prev[i];
+	}
+
+	if (bad) {
+		return TM_BAD;
+	}
+	if (*key) {
+		s->have_key = 1;
+	}
+	return s->have_key ? TM_RECORD : TM_SKIPPED;
+}
+
+#ifndef TM_NO_MAIN
+
+static void usage(void) {
+	fprintf(stderr, "Usage: telemetry-decode -s id:fields [-s id:fields ...] [-k] [file]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	FILE *in = stdin;
+	int show_key = 0;
+	int schemas = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ks:")) != -1) {
+		int id, fields;
+
+		switch (opt) {
+			case 'k': show_key = 1; break;
+			case 's':
+				if (sscanf(optarg, "%d:%d", &id, &fields) != 2
+					|| id < 0 || id >= TM_SCHEMAS || fields < 1 || fields > TM_FIELDS) {
+					fprintf(stderr, "Bad schema '%s'\n", optarg);
+					usage();
+				}
+				tm_define(id, fields);
+				schemas ++;
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (! schemas || argc - optind > 1) {
+		usage();
+	}
+	if (optind < argc && ! (in = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		return 2;
+	}
+
+	while (1) {
+		int16_t values[TM_FIELDS];
+		int id, key;
+
+		switch (tm_record(in, &id, values, &key)) {
+			case TM_EOF:
+				return 0;
+
+			case TM_SKIPPED:
+				break;
+
+			case TM_UNKNOWN:
+				fprintf(stderr, "Unknown schema %d\n", id);
+				return 1;
+
+			case TM_BAD:
+				fprintf(stderr, "Bad varint\n");
+				return 1;
+
+			case TM_RECORD:
+				printf("%d%s", id, show_key && key ? "*" : "");
+				for (int i = 0; i < tm_schemas[id].fields; ++i) {
+					printf(" %d", values[i]);
+				}
+				putchar('\n');
+				fflush(stdout);
+				break;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+**  Tullnet telemetry round-trip test
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Builds telemetry.c on the host with a serial-fmt which writes to
+**  memory, encodes random walks (with the occasional jump, wrap and
+**  reset) for two schemas, decodes them with host/telemetry-decode.c
+**  and checks every value. Prints the bytes per record against the
+**  same record as hex text, "XXXX XXXX XXXX\n". The exit status is
+**  non-zero on any mismatch.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "serial-fmt.h"
+#include "telemetry.h"
+
+#define TM_NO_MAIN
+#include "telemetry-decode.c"
+
+#define RECORDS 20000
+
+static unsigned char wire[RECORDS * 16];
+static size_t wire_len;
+
+void fmt_char(char c) {
+	wire[wire_len++] = c;
+}
+
+void fmt_flush(void) {
+}
+
+static uint32_t seed = 1;
+
+static uint32_t prng(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+TELEMETRY_SCHEMA(adc, 1, 3);
+TELEMETRY_SCHEMA(counters, 42, 2);
+
+static int16_t sent[RECORDS][3];
+static int sent_id[RECORDS];
+
+int main(void) {
+	int16_t a[3] = { 512, 3300, 0 };
+	int16_t c[2] = { 0, -100 };
+	int text_bytes = 0;
+	int fails = 0;
+
+	for (int r = 0; r < RECORDS; ++r) {
+		uint32_t x = prng();
+
+		if (x % 5) {
+			// Sensor-like: small steps, now and then a big one
+			a[0] += (int16_t) (x >> 8) % 5 - 2;
+			a[1] += (int16_t) (x >> 12) % 33 - 16;
+			a[2] ++;
+			if (x % 97 == 0) {
+				a[1] = prng();
+			}
+			if (x % 1013 == 0) {
+				telemetry_reset(&adc);
+			}
+			telemetry_send(&adc, a);
+			memcpy(sent[r], a, sizeof(a));
+			sent_id[r] = adc.id;
+			text_bytes += 3 * 5;
+		} else {
+			// Counters which wrap
+			c[0] += 1000;
+			c[1] -= x >> 24;
+			telemetry_send(&counters, c);
+			memcpy(sent[r], c, sizeof(c));
+			sent_id[r] = counters.id;
+			text_bytes += 2 * 5;
+		}
+	}
+
+	tm_define(adc.id, adc.fields);
+	tm_define(counters.id, counters.fields);
+
+	FILE *in = fmemopen(wire, wire_len, "rb");
+	int records = 0;
+
+	while (1) {
+		int16_t values[TM_FIELDS];
+		int id = -1, key = 0;
+		int rc = tm_record(in, &id, values, &key);
+
+		if (rc == TM_EOF) {
+			break;
+		}
+		if (rc != TM_RECORD || records >= RECORDS || id != sent_id[records]
+			|| memcmp(values, sent[records], tm_schemas[id].fields * sizeof(int16_t))) {
+			printf("FAIL: record %d (rc %d, schema %d)\n", records, rc, id);
+			fails ++;
+			break;
+		}
+		records ++;
+	}
+
+	if (records != RECORDS) {
+		printf("FAIL: decoded %d of %d records\n", records, RECORDS);
+		fails ++;
+	}
+
+	printf("telemetry: %d records, %zu bytes (%.2f per record), as hex text %d (%.1fx)\n",
+		RECORDS, wire_len, (double) wire_len / RECORDS, text_bytes,
+		(double) text_bytes / wire_len);
+
+	return fails != 0;
+}
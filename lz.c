@@ -0,0 +1,96 @@
+/*
+**  Tullnet streaming LZ compressor
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Greedy: the bytes held back always match at lz_dist. When the
+**  next byte does not, the other distances are tried before the
+**  repeat is sent, so the search (up to LZ_WINDOW x 17 compares) is
+**  only done where a match breaks. Free of AVR headers, for
+**  host/lz-bench.c.
+*/
+
+#include <stdint.h>
+
+#include "lz.h"
+
+#define MASK (LZ_WINDOW - 1)
+
+static unsigned char lz_window[LZ_WINDOW]; // Input so far, held back bytes included
+static uint8_t lz_pos;                 // Where the next byte goes
+static uint8_t lz_len;                 // Bytes held back
+static uint8_t lz_dist;                // They repeat from this far back
+
+void lz_reset(void) {
+	for (uint8_t i = 0; i < LZ_WINDOW; ++i) {
+		lz_window[i] = 0;
+	}
+	lz_pos = 0;
+	lz_len = 0;
+}
+
+static void _literal(unsigned char c) {
+	if (c >= LZ_REPEAT) {
+		lz_out(LZ_ESCAPE);
+	}
+	lz_out(c);
+}
+
+void lz_flush(void) {
+	if (lz_len >= LZ_MIN) {
+		lz_out(LZ_REPEAT | (lz_len - LZ_MIN));
+		lz_out(lz_dist - 1);
+	} else {
+		uint8_t p = lz_pos - lz_len;
+
+		while (lz_len--) {
+			_literal(lz_window[p++ & MASK]);
+		}
+	}
+	lz_len = 0;
+}
+
+/*
+**  _find(c)
+**    Look for a distance at which the held back bytes and then c
+**    repeat, nearest first. Return 0 if there is none.
+*/
+
+static uint8_t _find(unsigned char c) {
+	uint8_t start = lz_pos - lz_len;
+
+	for (uint8_t d = 1; d <= LZ_WINDOW - lz_len; ++d) {
+		uint8_t i;
+
+		for (i = 0; i < lz_len; ++i) {
+			if (lz_window[(uint8_t) (start + i - d) & MASK] != lz_window[(uint8_t) (start + i) & MASK]) {
+				break;
+			}
+		}
+		if (i == lz_len && lz_window[(uint8_t) (lz_pos - d) & MASK] == c) {
+			return d;
+		}
+	}
+
+	return 0;
+}
+
+void lz_char(unsigned char c) {
+	uint8_t d;
+
+	if (lz_len && lz_len < LZ_MAX && lz_window[(uint8_t) (lz_pos - lz_dist) & MASK] == c) {
+		lz_len ++;
+	} else if (lz_len < LZ_MAX && (d = _find(c))) {
+		lz_dist = d;
+		lz_len ++;
+	} else {
+		lz_flush();
+		if ((d = _find(c))) {
+			lz_dist = d;
+			lz_len = 1;
+		} else {
+			_literal(c);
+		}
+	}
+
+	lz_window[lz_pos++ & MASK] = c;
+}
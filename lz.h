@@ -0,0 +1,62 @@
+/*
+**  Tullnet streaming LZ compressor
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Compresses a byte stream against the last LZ_WINDOW bytes sent.
+**  SRAM use is the window and 3 bytes. The output is:
+**
+**     0x00-0xef        Literal byte
+**     0xff b           Literal byte b (for b 0xf0-0xff)
+**     0xf0|(n-3) d     Repeat n bytes (3-17) from d+1 bytes back
+**
+**  A repeat may overlap itself, so "UUUUUUUU" is a literal U and a
+**  repeat of 7 from 1 back. Both ends start with a window of zeros,
+**  and must be built with the same LZ_WINDOW. Text shrinks, most of
+**  all when whole lines repeat within the window; binary with many
+**  bytes over 0xef grows.
+**
+**  Compressed bytes go to lz_out(), which the program provides;
+**  serial-fmt does so when built with FMT_LZ. host/lz-decode.c
+**  decompresses.
+*/
+
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <stdint.h>
+
+// Window size: a power of 2 from 8 to 128. Lines which fit in it
+// compress to a few bytes when they are sent again.
+
+#ifndef LZ_WINDOW
+#define LZ_WINDOW  64
+#endif
+
+#if LZ_WINDOW < 8 || LZ_WINDOW > 128 || (LZ_WINDOW & (LZ_WINDOW - 1))
+#error "LZ_WINDOW must be a power of 2 from 8 to 128"
+#endif
+
+#define LZ_MIN     3
+#define LZ_MAX     17
+
+#define LZ_REPEAT  0xf0
+#define LZ_ESCAPE  0xff
+
+// Compress one byte. Up to LZ_MAX bytes are held back while a repeat
+// is being matched.
+
+void lz_char(unsigned char c);
+
+// Send whatever is held back
+
+void lz_flush(void);
+
+// Start again with an empty window; the decompressor must too
+
+void lz_reset(void);
+
+// Provided by the caller: send one compressed byte
+
+void lz_out(unsigned char c);
+
+#endif
@@ -7,6 +7,7 @@
 #include <avr/interrupt.h>
 
 #include "fd-serial.h"
+#include "serial-fmt.h"
 
 /* Set highest frequency CPU operation
 **  Startup frequency is assumed to be 1 MHz
@@ -20,29 +21,6 @@ void set_cpu_8mhz(void) {
 	// System clock is now 8 MHz
 }
 
-void writeString(char const *cp) {
-	while (*cp) {
-		fdserial_send(*cp++);
-	}
-}
-
-void write8(unsigned char c) {
-	unsigned char b = (c >> 4) + 0x30;
-	fdserial_send(b > 0x39 ? b + 7 : b);
-	b = (c & 0x0f) + 0x30;
-	fdserial_send(b > 0x39 ? b + 7 : b);
-}
-
-void write16(uint16_t i) {
-	write8(i >> 8);
-	write8(i & 0xff);
-}
-
-void write32(uint32_t i) {
-	write16(i >> 16);
-	write16(i & 0xffff);
-}
-
 volatile uint8_t count_int0 = 0;
 volatile uint8_t start_cycles = 0;
 volatile uint8_t start_counter = 0;
@@ -81,41 +59,42 @@ int main(void)
 		loops ++;
 		tcnt1 = TCNT1;
 		if (tcnt1 >= 208) {
-			fdserial_send('O');
-			write8(tcnt1);
+			fmt_char('O');
+			fmt_hex8(tcnt1);
+			fmt_flush();
 		}
 
 		if (loops % 100000 == 0) {
 			if (a_index > 0) {
 				uint8_t i;
-				fdserial_send('W');
+				fmt_char('W');
 				for (i = 0; i < a_index; ++i) {
-					write8(a_cycle[i]);
-					fdserial_send(':');
-					write8(a_counter[i]);
-					fdserial_send(' ');
+					fmt_hex8(a_cycle[i]);
+					fmt_char(':');
+					fmt_hex8(a_counter[i]);
+					fmt_char(' ');
 				}
 				a_index = 0;
-				fdserial_send('\n');
+				fmt_char('\n');
 			}
 			if (cp > buf) {
 				unsigned char *cp2 = buf;
-				fdserial_send('<');
+				fmt_char('<');
 				while (cp2 < cp) {
-					write8(*cp2++);
-					fdserial_send(' ');
+					fmt_hex8(*cp2++);
+					fmt_char(' ');
 				}
-				fdserial_send('>');
+				fmt_char('>');
 				cp = buf;
 			}
 
-			fdserial_send('C');
-			fdserial_send(' ');
-			write8(OCR1A);
-			fdserial_send(' ');
-			write8(OCR1B);
-			fdserial_send('\n');
-
+			fmt_char('C');
+			fmt_char(' ');
+			fmt_hex8(OCR1A);
+			fmt_char(' ');
+			fmt_hex8(OCR1B);
+			fmt_char('\n');
+			fmt_flush();
 		}
 
 		if (fdserial_available()) {
@@ -144,7 +123,8 @@ int main(void)
 		*cp++ = '\n';
 		*cp++ = '\0';
 
-		// writeString("U sent: ");
-		writeString(line);
+		// fmt_string("U sent: ");
+		fmt_string(line);
+		fmt_flush();
 	}
 }
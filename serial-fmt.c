@@ -0,0 +1,189 @@
+/*
+**  Tullnet buffered formatted output
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Build with the same SERIAL_BACKEND and fd-serial options as the
+**  program, since they decide how the buffer is sent.
+*/
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "serial.h"
+#include "serial-fmt.h"
+#ifdef FMT_LZ
+#include "lz.h"
+#endif
+
+#if SERIAL_BACKEND == SERIAL_FDSERIAL && defined(SEND_BUFFER)
+#define FMT_HALVES 2
+#else
+#define FMT_HALVES 1
+#endif
+
+#define FMT_SIZE (FMT_BUFFER / FMT_HALVES)
+
+#if FMT_SIZE < 1 || FMT_SIZE > 255
+#error "FMT_BUFFER is out of range"
+#endif
+
+static char fmt_buf[FMT_BUFFER];
+static char *fmt_half = fmt_buf;       // Half being filled
+static uint8_t fmt_len;                // Bytes in it
+
+/*
+**  _send()
+**    With two halves, hand the filled one to the tx ISR and fill the
+**    other; fdserial_send_buffer() first waits until the tx ISR has
+**    taken the last byte of the other, so it is then free.
+*/
+
+static void _send(void) {
+	if (! fmt_len) {
+		return;
+	}
+
+#if FMT_HALVES == 2
+	fdserial_send_buffer(fmt_half, fmt_len, 0);
+	fmt_half = fmt_half == fmt_buf ? fmt_buf + FMT_SIZE : fmt_buf;
+#else
+	for (uint8_t i = 0; i < fmt_len; ++i) {
+		serial_send(fmt_buf[i]);
+	}
+#endif
+	fmt_len = 0;
+}
+
+static void _put(char c) {
+	fmt_half[fmt_len++] = c;
+	if (fmt_len == FMT_SIZE) {
+		_send();
+	}
+}
+
+#ifdef FMT_LZ
+// The compressor sits between the fmt_ calls and the buffer
+
+void lz_out(unsigned char c) {
+	_put(c);
+}
+
+void fmt_char(char c) {
+	lz_char(c);
+}
+
+void fmt_flush(void) {
+	lz_flush();
+	_send();
+}
+#else
+void fmt_char(char c) {
+	_put(c);
+}
+
+void fmt_flush(void) {
+	_send();
+}
+#endif
+
+static int _stream_put(char c, FILE *stream) {
+	fmt_char(c);
+	if (c == '\n') {
+		fmt_flush();
+	}
+	return 0;
+}
+
+FILE fmt_stream = FDEV_SETUP_STREAM(_stream_put, NULL, _FDEV_SETUP_WRITE);
+
+void fmt_string(const char *s) {
+	while (*s) {
+		fmt_char(*s++);
+	}
+}
+
+void fmt_string_P(const char *s_P) {
+	char c;
+
+	while ((c = pgm_read_byte(s_P++))) {
+		fmt_char(c);
+	}
+}
+
+/*
+**  Hex digits are '0' + n, skipping the 7 chars between '9' and 'A'.
+*/
+
+static void _hex_digit(uint8_t n) {
+	n = (n & 0x0f) + '0';
+	fmt_char(n > '9' ? n + 7 : n);
+}
+
+void fmt_hex8(uint8_t n) {
+	_hex_digit(n >> 4);
+	_hex_digit(n);
+}
+
+void fmt_hex16(uint16_t n) {
+	fmt_hex8(n >> 8);
+	fmt_hex8(n);
+}
+
+void fmt_hex32(uint32_t n) {
+	fmt_hex16(n >> 16);
+	fmt_hex16(n);
+}
+
+/*
+**  _div10(n, &rem)
+**    Divide by 10 with shifts and adds, as the ATtiny has neither a
+**    divide nor a multiply instruction. q starts as n * 0.8 and is
+**    then at most 1 too small (Hacker's Delight, divu10); the
+**    remainder fits in a byte, so it is corrected in 8 bits.
+*/
+
+static uint32_t _div10(uint32_t n, uint8_t *rem) {
+	uint32_t q = (n >> 1) + (n >> 2);
+
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q >>= 3;
+
+	uint8_t q8 = q;
+	uint8_t r = (uint8_t) n - (uint8_t) ((q8 << 3) + (q8 << 1));
+
+	if (r > 9) {
+		q ++;
+		r -= 10;
+	}
+
+	*rem = r;
+	return q;
+}
+
+void fmt_dec(uint32_t n) {
+	char digits[10];
+	uint8_t i = 0;
+	uint8_t r;
+
+	do {
+		n = _div10(n, &r);
+		digits[i++] = '0' + r;
+	} while (n);
+
+	while (i) {
+		fmt_char(digits[--i]);
+	}
+}
+
+void fmt_sdec(int32_t n) {
+	if (n < 0) {
+		fmt_char('-');
+		fmt_dec(- (uint32_t) n);
+	} else {
+		fmt_dec(n);
+	}
+}
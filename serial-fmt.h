@@ -0,0 +1,83 @@
+/*
+**  Tullnet buffered formatted output
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  A stdio stream and hex/decimal writers on the serial backend
+**  chosen in serial.h. Output is collected in a buffer and sent when
+**  the buffer is full, at a newline written through the stream, or
+**  on fmt_flush(), so the caller only waits when it gets ahead of the
+**  line.
+**
+**  With fd-serial built with SEND_BUFFER the buffer has two halves:
+**  the tx ISR sends one straight from RAM while the other fills.
+**  Otherwise a flush sends the bytes one at a time.
+**
+**  Usage:
+**
+**     stdout = &fmt_stream;
+**     printf("count %u\n", count);
+**
+**     fmt_hex16(OCR1A);
+**     fmt_dec(loops);
+**     fmt_char('\n');
+**     fmt_flush();
+**
+**  The fmt_ calls convert without printf, division or lookup tables,
+**  and write into the same buffer as the stream. Flush before
+**  sending with the backend's own calls, to keep the bytes in order.
+*/
+
+#ifndef _SERIAL_FMT_H
+#define _SERIAL_FMT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Bytes of output buffer. Halved with SEND_BUFFER.
+
+#ifndef FMT_BUFFER
+#define FMT_BUFFER 32
+#endif
+
+// Compression (optional).
+//
+// With FMT_LZ, everything written is compressed by lz.c on its way
+// into the buffer; link lz.o too. The receiver decompresses with
+// host/lz-decode. fmt_flush() ends any repeat being matched, so
+// flush at the end of a burst rather than after every field.
+
+// #define FMT_LZ
+
+// Writes to the serial port; a newline flushes
+
+extern FILE fmt_stream;
+
+// Append one char
+
+void fmt_char(char c);
+
+// Append a string from RAM or from flash
+
+void fmt_string(const char *s);
+
+void fmt_string_P(const char *s_P);
+
+// Append 2, 4 or 8 upper case hex digits
+
+void fmt_hex8(uint8_t n);
+
+void fmt_hex16(uint16_t n);
+
+void fmt_hex32(uint32_t n);
+
+// Append an unsigned or signed decimal number
+
+void fmt_dec(uint32_t n);
+
+void fmt_sdec(int32_t n);
+
+// Send whatever is in the buffer
+
+void fmt_flush(void);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+**  Tullnet serial interface
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  One set of calls for whichever software UART is linked in. Set
+**  SERIAL_BACKEND in CFLAGS to choose one:
+**
+**     SERIAL_FDSERIAL  Timer1, full duplex (fd-serial.c, libfdserial.a)
+**     SERIAL_SERIAL0   Timer0, half duplex (serial0.c, libserial0.a)
+**
+**  The calls are static inline, so they compile to a direct call of
+**  the backend. Options of the backend (RING_BUFFER, FD_COMPACT and
+**  so on) are set as usual, and its own calls may still be used.
+**
+**  Usage:
+**
+**     serial_init();
+**     sei();
+**     while (1) {
+**         if (serial_available()) {
+**             serial_send(serial_recv());
+**         }
+**     }
+**
+**  serial_available() must be called often with serial0, which
+**  looks for a start bit in it.
+*/
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include <stdint.h>
+
+#define SERIAL_FDSERIAL 1
+#define SERIAL_SERIAL0  2
+
+#ifndef SERIAL_BACKEND
+#define SERIAL_BACKEND SERIAL_FDSERIAL
+#endif
+
+#if SERIAL_BACKEND == SERIAL_FDSERIAL
+
+#include "fd-serial.h"
+
+#define SERIAL_NAME "fd-serial"
+#define SERIAL_FULL_DUPLEX 1
+
+static inline void serial_init(void) {
+	fdserial_init();
+}
+
+static inline uint8_t serial_available(void) {
+	return fdserial_available();
+}
+
+static inline uint8_t serial_sendok(void) {
+	return fdserial_sendok();
+}
+
+static inline void serial_send(unsigned char c) {
+	fdserial_send(c);
+}
+
+static inline unsigned char serial_recv(void) {
+	return fdserial_recv();
+}
+
+static inline void serial_delay(uint32_t ms) {
+	fdserial_delay(ms);
+}
+
+static inline void serial_send_break(uint16_t bit_times) {
+	fdserial_send_break(bit_times);
+}
+
+#elif SERIAL_BACKEND == SERIAL_SERIAL0
+
+#include "serial0.h"
+
+#define SERIAL_NAME "serial0"
+#define SERIAL_FULL_DUPLEX 0
+
+static inline void serial_init(void) {
+	serial0_init();
+}
+
+static inline uint8_t serial_available(void) {
+	return serial0_poll();
+}
+
+static inline uint8_t serial_sendok(void) {
+	return serial0_sendok();
+}
+
+static inline void serial_send(unsigned char c) {
+	serial0_send(c);
+}
+
+static inline unsigned char serial_recv(void) {
+	return serial0_recv();
+}
+
+static inline void serial_delay(uint32_t ms) {
+	serial0_delay(ms);
+}
+
+static inline void serial_send_break(uint16_t bit_times) {
+	serial0_send_break(bit_times);
+}
+
+#else
+#error "Unknown SERIAL_BACKEND"
+#endif
+
+#endif
@@ -92,6 +92,12 @@ void serial0_init(void) {
 	DDRB &= ~( S0_RX_PIN );
 	PORTB |= S0_RX_PIN;
 
+#ifdef S0_DE_PIN
+	// Driver enable output, off
+	DDRB |= S0_DE_PIN;
+	PORTB &= ~( S0_DE_PIN );
+#endif
+
 	_stoptimer();
 	TCCR0A = com_mode | wgm1_mode;
 	TCCR0B = wgm2_mode;
@@ -107,6 +113,20 @@ uint8_t serial0_available(void) {
 	return uart.available;
 }
 
+/*
+**  serial0_poll()
+**   If nothing is being sent or received, look for a start bit.
+**   Return true if a character has been received.
+*/
+
+uint8_t serial0_poll(void) {
+	if (! uart.available && uart.state == 0) {
+		serial0_startbit();
+	}
+
+	return uart.available;
+}
+
 /*
 **  serial0_sendok()
 **    Return true if the transmit interface is free to transmit a character
@@ -127,6 +147,13 @@ uint8_t serial0_startbit(void) {
 		return 0;
 	}
 
+#ifdef S0_DE_PIN
+	if (PORTB & S0_DE_PIN) {
+		// Our own transmission
+		return 0;
+	}
+#endif
+
 	// This will ensure an interrupt half a bit time hence
 	uint8_t tcnt0 = TCNT0;
 	if (tcnt0 >= SERIAL_HALFBIT) {
@@ -216,6 +243,27 @@ void serial0_delay(uint32_t duration) {
 	while (! uart.send_ready) { }
 }
 
+/*
+**  serial0_send_break(bit_times)
+**
+**  Wait until the transmitter is free, then hold the line
+**  low for bit_times.
+*/
+
+void serial0_send_break(uint16_t bit_times) {
+	if (! bit_times) {
+		return;
+	}
+
+	// Wait until previous byte finished
+	while (! uart.send_ready) { }
+
+	OCR0B = TCNT0;
+	uart.delay = bit_times;
+	uart.send_ready = 0;
+	uart.state = 9;
+}
+
 
 // Interrupt routine for timer1, TCCR1A, tx bits
 
@@ -230,6 +278,9 @@ ISR(TIMER0_COMPB_vect)
 			break;
 
 		case 1: // Send start bit
+#ifdef S0_DE_PIN
+			PORTB |= S0_DE_PIN;
+#endif
 			PORTB &= ~( S0_TX_PIN );
 			uart.state = 2;
 			uart.bits = 8;
@@ -254,6 +305,10 @@ ISR(TIMER0_COMPB_vect)
 			break;
 
 		case 4: // Return to idle mode
+#ifdef S0_DE_PIN
+			// End of stop bit, release the bus
+			PORTB &= ~( S0_DE_PIN );
+#endif
 			uart.send_ready = 1;
 			uart.state = 0;
 			break;
@@ -289,15 +344,26 @@ ISR(TIMER0_COMPB_vect)
 				uart.state = 0;
 				_stoptimer();
 			} else {
-				// Framing error
+				// Framing error, or a break if all bits were low
 				// Would like to wait for next byte at this point (later)
 				uart.recv_byte = 0;
-				uart.available = 2;
+				uart.available = uart.recv_shift ? 2 : 3;
 				uart.state = 0;
 				_stoptimer();
 			}
 
 			break;
 
+		case 9: // Break
+#ifdef S0_DE_PIN
+			PORTB |= S0_DE_PIN;
+#endif
+			PORTB &= ~( S0_TX_PIN );
+			if (! --uart.delay) {
+				// Stop bit next
+				uart.state = 3;
+			}
+			break;
+
 	}
 }
@@ -16,13 +16,19 @@
 #define S0_RX_PIN   (1<<PINB2)
 #define S0_TX_PIN   (1<<PORTB3)
 
+// RS-485 driver enable (optional). S0_DE_PIN is raised with the
+// start bit and lowered at the end of the stop bit. No start bit
+// is detected while it is raised.
+
+// #define S0_DE_PIN   (1<<PORTB4)
+
 struct serial0_uart {
 	volatile uint8_t state;
 	volatile unsigned char send_byte;
 	volatile unsigned char recv_byte;
 	volatile unsigned char recv_shift;
 	volatile uint8_t bits;
-	volatile uint8_t available;
+	volatile uint8_t available;     // 1 = byte, 2 = framing error, 3 = break
 	volatile uint8_t send_ready;   // 1 = can send a byte
 	volatile uint32_t delay;       // No of bit times to delay
 };
@@ -35,6 +41,16 @@ void serial0_init(void);
 
 uint8_t serial0_startbit(void);
 
+// Return non-zero if a character has been received: 1 = byte,
+// 2 = framing error, 3 = break. serial0_recv() then returns it.
+
+uint8_t serial0_available(void);
+
+// As serial0_available(), but first look for a start bit if the
+// UART is idle. Call it often, as serial0 has no start bit interrupt.
+
+uint8_t serial0_poll(void);
+
 uint8_t serial0_sendok(void);
 
 void serial0_send(unsigned char send_arg);
@@ -49,4 +65,8 @@ void serial0_alarm(uint32_t duration);
 
 void serial0_delay(uint32_t duration);
 
+// Hold the line low for bit_times, then high for a bit time
+
+void serial0_send_break(uint16_t bit_times);
+
 #endif
@@ -0,0 +1,440 @@
+/*
+**  Tullnet Full Duplex Serial UART, C++ template version
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  This is the fd-serial state machine as a header-only template.
+**  Pins, ring sizes and bit timing are template parameters, so
+**  they are compile-time constants in the generated code and any
+**  function which is not called is never instantiated.
+**
+**  ATtiny85
+**     This code uses Timer/Counter 1
+**     RX on any PORTB pin (INT0 if PB2, otherwise PCINT0)
+**     TX on any PORTB pin
+**
+**  Usage:
+**
+**     typedef SoftUart<PB2, PB3, 9600, 16, 8> Uart;
+**     SOFTUART_ISRS(Uart)
+**
+**     Uart::init(); sei(); Uart::send('x');
+**
+**  Several instances may coexist. Each one has its own state, but
+**  they share Timer1, so they must use the same bit rate and at
+**  most one of them may receive (the others use NoPin for RxPin).
+**  Write the ISRs by hand in that case, calling every instance's
+**  tx_tick() from TIMER1_COMPA_vect.
+*/
+
+#ifndef _SOFT_UART_HPP
+#define _SOFT_UART_HPP
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#ifndef CPU_FREQ
+#define CPU_FREQ 8000000
+#endif
+
+namespace softuart {
+
+// Use for RxPin or TxPin to leave that direction out entirely
+const uint8_t NoPin = 0xff;
+
+// Full duplex needs INT0, COMPA and COMPB to all fit in one bit time,
+// with room left over to sample close to the centre of the bit.
+const uint32_t MinCyclesPerBit = 200;
+
+/*
+**  Find the smallest Timer1 prescaler (CK / 2^Shift) for which
+**  one bit time, rounded as in Timing, fits in the 8-bit counter.
+*/
+
+template <uint32_t Baud, uint8_t Shift = 0>
+struct Prescale {
+	static const uint32_t divisor = (uint32_t) Baud << Shift;
+	static const uint8_t shift =
+		(CPU_FREQ + divisor / 2) / divisor <= 256 ? Shift : Prescale<Baud, Shift + 1>::shift;
+};
+
+template <uint32_t Baud>
+struct Prescale<Baud, 15> {
+	static const uint8_t shift = 15;
+};
+
+/*
+**  Bit timing for a given rate. Rejects rates which Timer1 cannot
+**  generate accurately or which the ISRs cannot keep up with.
+*/
+
+template <uint32_t Baud>
+struct Timing {
+	static const uint8_t shift = Prescale<Baud>::shift;
+	static const uint32_t divisor = (uint32_t) Baud << shift;
+	static const uint16_t ticks = (CPU_FREQ + divisor / 2) / divisor;
+	static const uint32_t actual = CPU_FREQ / ((uint32_t) ticks << shift);
+	static const uint32_t error = (actual > Baud ? actual - Baud : Baud - actual) * 1000 / Baud;
+
+	// CS13..CS10 = 0001 is CK, 0010 is CK/2 ... 1111 is CK/16384
+	static const uint8_t prescaler = shift + 1;
+	static const uint8_t top = ticks - 1;
+	static const uint8_t halfbit = ticks / 2;
+
+	static_assert(shift <= 14, "bit rate too low for Timer1 at this CPU_FREQ");
+	static_assert(ticks >= 2 && ticks <= 256, "bit time does not fit Timer1");
+	static_assert(CPU_FREQ / Baud >= MinCyclesPerBit, "bit rate too high for full duplex at this CPU_FREQ");
+	static_assert(error <= 20, "bit rate error exceeds 2% at this CPU_FREQ");
+};
+
+/*
+**  Byte ring. Holds up to N-1 bytes, same as the fd-serial rx_buf.
+**  Ring<0> is a single holding register, like fd-serial without
+**  RING_BUFFER.
+*/
+
+template <uint8_t N>
+struct Ring {
+	volatile uint8_t buf[N];
+	volatile uint8_t head;  // Index of next char to append
+	volatile uint8_t tail;  // Index of next char to remove
+
+	static uint8_t next(uint8_t i) {
+		// Don't use the 'mod' operation because it is expensive.
+		return i == N - 1 ? 0 : i + 1;
+	}
+
+	uint8_t count() const {
+		// Not a signed difference: N may be over 128
+		return head >= tail ? head - tail : head + N - tail;
+	}
+
+	bool empty() const { return head == tail; }
+	bool full() const { return next(head) == tail; }
+
+	void put(uint8_t c) {
+		buf[head] = c;
+		head = next(head);
+	}
+
+	// Append, dropping the oldest char if the ring is full
+	void put_overwrite(uint8_t c) {
+		put(c);
+		if (head == tail) {
+			tail = next(tail);
+		}
+	}
+
+	uint8_t get() {
+		uint8_t c = buf[tail];
+		tail = next(tail);
+		return c;
+	}
+};
+
+template <>
+struct Ring<0> {
+	volatile uint8_t byte;
+	volatile uint8_t used;
+
+	uint8_t count() const { return used; }
+	bool empty() const { return !used; }
+	bool full() const { return used; }
+	void put(uint8_t c) { byte = c; used = 1; }
+	void put_overwrite(uint8_t c) { put(c); }
+	uint8_t get() { used = 0; return byte; }
+};
+
+/*
+**  Timer1 compare A is shared by every transmitting instance.
+**  It stays enabled while any of them is sending.
+*/
+
+template <class Unused = void>
+struct Timer1Users {
+	static volatile uint8_t tx_active;
+};
+
+template <class Unused>
+volatile uint8_t Timer1Users<Unused>::tx_active;
+
+template <uint8_t RxPin, uint8_t TxPin, uint32_t Baud, uint8_t RxBuf = 16, uint8_t TxBuf = 0>
+class SoftUart {
+public:
+	typedef Timing<Baud> timing;
+
+	static const bool has_rx = RxPin != NoPin;
+	static const bool has_tx = TxPin != NoPin;
+	static const uint8_t rx_mask = has_rx ? 1 << RxPin : 0;
+	static const uint8_t tx_mask = has_tx ? 1 << TxPin : 0;
+	// INT0 is only available on PB2. Other pins use PCINT0.
+	static const bool rx_int0 = RxPin == PB2;
+
+	static_assert(!has_rx || RxPin <= PB5, "RxPin must be a PORTB pin");
+	static_assert(!has_tx || TxPin <= PB5, "TxPin must be a PORTB pin");
+	static_assert(RxPin != TxPin || !has_rx, "RxPin and TxPin must differ");
+	static_assert(RxBuf != 1 && TxBuf != 1, "a ring of 1 holds nothing; use 0 or at least 2");
+
+	/*
+	**  Initialise the state, timer, interrupts and pins.
+	**  Timer1 runs in CTC mode with one compare cycle per bit.
+	*/
+
+	static void init() {
+		s.tx_state = 0;
+		s.rx_state = 0;
+
+		TCNT1 = 0;
+		OCR1A = 0; // send bit timing, never moved
+		OCR1B = timing::halfbit; // receive bit timing
+		OCR1C = timing::top;
+		TCCR1 = 1<<CTC1 | timing::prescaler;
+
+		if (has_tx) {
+			DDRB |= tx_mask;
+			PORTB |= tx_mask;
+		}
+
+		if (has_rx) {
+			DDRB &= ~rx_mask;
+			PORTB |= rx_mask;
+
+			if (rx_int0) {
+				// Configure INT0 to interrupt on falling edge
+				MCUCR |= 1<<ISC01;
+			} else {
+				GIMSK |= 1<<PCIE;
+			}
+
+			_enable_edge();
+		}
+	}
+
+	// Return count of bytes available to read
+
+	static uint8_t available() {
+		return s.rx.count();
+	}
+
+	// Return true when a byte can be sent without waiting
+
+	static bool sendok() {
+		return !s.tx.full();
+	}
+
+	/*
+	**  Queue a byte for sending. Waits only if the tx ring
+	**  (or, with TxBuf = 0, the byte being sent) is full.
+	*/
+
+	static void send(uint8_t c) {
+		static_assert(has_tx, "send() needs a TxPin");
+
+		while (s.tx.full()) { }
+
+		uint8_t sreg = SREG;
+		cli();
+		s.tx.put(c);
+		if (!s.tx_state) {
+			s.tx_state = 1; // Send start bit on next tick
+			if (!Timer1Users<>::tx_active++) {
+				// Writing 1 clears a flag, so |= would clear them all
+				TIFR = 1<<OCF1A;
+				TIMSK |= 1<<OCIE1A;
+			}
+		}
+		SREG = sreg;
+	}
+
+	/*
+	**  Return the next received byte, waiting if necessary.
+	*/
+
+	static uint8_t recv() {
+		static_assert(has_rx, "recv() needs an RxPin");
+
+		while (s.rx.empty()) { }
+
+		return s.rx.get();
+	}
+
+	/*
+	**  Call from TIMER1_COMPA_vect. Outputs one bit per tick.
+	*/
+
+	static inline void tx_tick() __attribute__((always_inline)) {
+		if (!has_tx) {
+			return;
+		}
+
+		switch (s.tx_state) {
+			case 0: // Idle
+				return;
+
+			case 1: // Send start bit
+				PORTB &= ~tx_mask;
+				s.send_byte = s.tx.get();
+				s.send_bits = 8;
+				s.tx_state = 2;
+				return;
+
+			case 2: // Send a bit
+				if (s.send_byte & 1) {
+					PORTB |= tx_mask;
+				} else {
+					PORTB &= ~tx_mask;
+				}
+				s.send_byte >>= 1;
+
+				if (! --s.send_bits) {
+					s.tx_state = 3;
+				}
+				return;
+
+			case 3: // Send stop bit
+				PORTB |= tx_mask;
+				s.tx_state = 4;
+				return;
+
+			case 4: // End of stop bit
+				if (!s.tx.empty()) {
+					// Start the next byte without an idle tick
+					PORTB &= ~tx_mask;
+					s.send_byte = s.tx.get();
+					s.send_bits = 8;
+					s.tx_state = 2;
+					return;
+				}
+
+				s.tx_state = 0;
+				if (! --Timer1Users<>::tx_active) {
+					TIMSK &= ~( 1<<OCIE1A );
+				}
+				return;
+		}
+	}
+
+	/*
+	**  Call from TIMER1_COMPB_vect. Samples one bit per tick.
+	*/
+
+	static inline void rx_tick() __attribute__((always_inline)) {
+		if (!has_rx) {
+			return;
+		}
+
+		// Read the bit as early as possible, to try to hit the
+		// center mark
+		uint8_t read_bit = PINB & rx_mask;
+
+		switch (s.rx_state) {
+			case 0: // Midpoint of start bit. Go on to first data bit.
+				s.rx_state = 2;
+				s.recv_bits = 8;
+				break;
+
+			case 2: // Reading a data bit
+				s.recv_shift >>= 1;
+				if (read_bit) {
+					s.recv_shift |= 0x80;
+				}
+
+				if (! --s.recv_bits) {
+					s.rx_state = 3;
+				}
+				break;
+
+			case 3: // Byte done, wait for high
+				if (read_bit) {
+					s.rx.put_overwrite(s.recv_shift);
+					s.rx_state = 0;
+					TIMSK &= ~( 1<<OCIE1B );
+					_enable_edge();
+				}
+				break;
+		}
+	}
+
+	/*
+	**  Call from INT0_vect (RxPin = PB2) or PCINT0_vect (other pins).
+	**  It is the beginning of a start bit.
+	*/
+
+	static inline void rx_edge() __attribute__((always_inline)) {
+		if (!has_rx) {
+			return;
+		}
+
+		uint8_t tcnt1 = TCNT1;
+
+		// Pin change interrupts fire on both edges
+		if (!rx_int0 && (PINB & rx_mask)) {
+			return;
+		}
+
+		// Set sample time, half a bit after now.
+		if (tcnt1 >= timing::halfbit) {
+			OCR1B = tcnt1 - timing::halfbit;
+		} else {
+			OCR1B = tcnt1 + timing::halfbit;
+		}
+
+		_disable_edge();
+		TIFR = 1<<OCF1B;
+		TIMSK |= 1<<OCIE1B;
+	}
+
+private:
+	struct State {
+		volatile uint8_t tx_state;
+		volatile uint8_t rx_state;
+		volatile uint8_t send_byte;   // byte presently being sent (shifted)
+		volatile uint8_t recv_shift;  // rx data shifted into this byte
+		volatile uint8_t send_bits;   // Number of bits remaining to send
+		volatile uint8_t recv_bits;   // Number of bits remaining to receive
+		Ring<RxBuf> rx;
+		Ring<TxBuf> tx;
+	};
+
+	static State s;
+
+	static void _enable_edge() {
+		if (rx_int0) {
+			GIFR = 1<<INTF0;
+			GIMSK |= 1<<INT0;
+		} else {
+			GIFR = 1<<PCIF;
+			PCMSK |= rx_mask;
+		}
+	}
+
+	static void _disable_edge() {
+		if (rx_int0) {
+			GIMSK &= ~( 1<<INT0 );
+		} else {
+			PCMSK &= ~rx_mask;
+		}
+	}
+};
+
+template <uint8_t RxPin, uint8_t TxPin, uint32_t Baud, uint8_t RxBuf, uint8_t TxBuf>
+typename SoftUart<RxPin, TxPin, Baud, RxBuf, TxBuf>::State SoftUart<RxPin, TxPin, Baud, RxBuf, TxBuf>::s;
+
+} // namespace softuart
+
+/*
+**  Define the interrupt handlers for a single instance.
+**  U must be a typedef (the template arguments contain commas).
+*/
+
+#define SOFTUART_ISRS(U) \
+	ISR(TIMER1_COMPA_vect) { U::tx_tick(); } \
+	ISR(TIMER1_COMPB_vect) { U::rx_tick(); } \
+	ISR(INT0_vect) { U::rx_edge(); }
+
+#define SOFTUART_ISRS_PCINT(U) \
+	ISR(TIMER1_COMPA_vect) { U::tx_tick(); } \
+	ISR(TIMER1_COMPB_vect) { U::rx_tick(); } \
+	ISR(PCINT0_vect) { U::rx_edge(); }
+
+#endif
@@ -0,0 +1,58 @@
+/*
+**  Tullnet binary telemetry encoder
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Free of AVR headers, so that host/telemetry-test.c can build it
+**  on the host.
+*/
+
+#include <stdint.h>
+
+#include "serial-fmt.h"
+#include "telemetry.h"
+
+static void _varint(uint16_t n) {
+	while (n >= 0x80) {
+		fmt_char(n | 0x80);
+		n >>= 7;
+	}
+	fmt_char(n);
+}
+
+/*
+**  Zigzag: the sign goes to bit 0, so -1 is 1 rather than 0xffff
+*/
+
+static uint16_t _zigzag(uint16_t n) {
+	return n & 0x8000 ? ~(n << 1) : n << 1;
+}
+
+/*
+**  telemetry_send(schema, values)
+**    Send a record, as deltas from the values last sent unless a
+**    keyframe is due.
+*/
+
+void telemetry_send(struct telemetry_schema *schema, const int16_t *values) {
+	uint8_t key = schema->count == 0;
+	int16_t *prev = schema->prev;
+
+	_varint(schema->id << 1 | key);
+
+	for (uint8_t i = 0; i < schema->fields; ++i) {
+		uint16_t v = values[i];
+
+		_varint(_zigzag(key ? v : v - (uint16_t) prev[i]));
+		prev[i] = v;
+	}
+
+	if (++schema->count == TELEMETRY_KEYFRAME) {
+		schema->count = 0;
+	}
+
+	fmt_flush();
+}
+
+void telemetry_reset(struct telemetry_schema *schema) {
+	schema->count = 0;
+}
@@ -0,0 +1,66 @@
+/*
+**  Tullnet binary telemetry encoder
+**  (C) 2010, Nick Andrew <nick@tull.net>
+**
+**  Sends records of 16-bit fields in a few bytes each, instead of
+**  hex text. A record is:
+**
+**     varint(schema id << 1 | key)  then, for each field,
+**     varint(zigzag(value))            if key is 1 (a keyframe)
+**     varint(zigzag(value - previous)) if key is 0
+**
+**  Varints hold 7 bits per byte, low bits first, with the top bit set
+**  on all but the last byte. Zigzag maps 0, -1, 1, -2 ... to 0, 1, 2,
+**  3 ... so that small changes either way take one byte. Differences
+**  are taken modulo 65536, so a field may wrap.
+**
+**  The schema id says which fields follow; the receiver must be told
+**  how many each schema has (see host/telemetry-decode.c). Ids below
+**  64 take one byte. Every TELEMETRY_KEYFRAME records, and after
+**  telemetry_reset(), a schema sends absolute values, so that a
+**  receiver which starts late (at a record boundary) catches up.
+**  There is no framing: a lost byte puts the receiver out of step.
+**
+**  Records are written with serial-fmt and flushed at the end.
+**
+**  Usage:
+**
+**     TELEMETRY_SCHEMA(adc, 1, 3);
+**
+**     int16_t v[3] = { temp, volts, count };
+**     telemetry_send(&adc, v);
+*/
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+
+// Records between keyframes of one schema, including the keyframe
+
+#ifndef TELEMETRY_KEYFRAME
+#define TELEMETRY_KEYFRAME 16
+#endif
+
+struct telemetry_schema {
+	uint8_t id;                 // 0-127
+	uint8_t fields;             // Values per record
+	uint8_t count;              // Records since the keyframe, 0 = send one
+	int16_t *prev;              // Values last sent
+};
+
+// Define a schema called name, with its own previous values
+
+#define TELEMETRY_SCHEMA(name, schema_id, nr_fields) \
+	static int16_t name##_prev[nr_fields]; \
+	struct telemetry_schema name = { (schema_id), (nr_fields), 0, name##_prev }
+
+// Send one record of schema->fields values
+
+void telemetry_send(struct telemetry_schema *schema, const int16_t *values);
+
+// Make the next record of the schema a keyframe
+
+void telemetry_reset(struct telemetry_schema *schema);
+
+#endif
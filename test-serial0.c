@@ -7,6 +7,7 @@
 #include <avr/interrupt.h>
 
 #include "serial0.h"
+#include "serial-fmt.h"
 
 /* Set highest frequency CPU operation
 **  Startup frequency is assumed to be 1 MHz
@@ -20,29 +21,6 @@ void set_cpu_8mhz(void) {
 	// System clock is now 8 MHz
 }
 
-void writeString(char const *cp) {
-	while (*cp) {
-		serial0_send(*cp++);
-	}
-}
-
-void write8(unsigned char c) {
-	unsigned char b = (c >> 4) + 0x30;
-	serial0_send(b > 0x39 ? b + 7 : b);
-	b = (c & 0x0f) + 0x30;
-	serial0_send(b > 0x39 ? b + 7 : b);
-}
-
-void write16(uint16_t i) {
-	write8(i >> 8);
-	write8(i & 0xff);
-}
-
-void write32(uint32_t i) {
-	write16(i >> 16);
-	write16(i & 0xffff);
-}
-
 volatile uint8_t cycle_count = 0;
 volatile uint8_t count_int0 = 0;
 volatile uint8_t tcnt1 = 0;
@@ -101,9 +79,11 @@ int main(void)
 	uint8_t old_tcnt1 = 0;
 
 	serial0_delay(20000);
-	writeString("Starting\n");
+	fmt_string("Starting\n");
+	fmt_flush();
 	serial0_delay(20000);
-	writeString("Really starting\n");
+	fmt_string("Really starting\n");
+	fmt_flush();
 	serial0_delay(20000);
 
 	while (1) {
@@ -125,19 +105,18 @@ int main(void)
 		old_tcnt1 = tcnt1;
 
 		if (cycle_10 && !done) {
-			writeString("Done: <");
-			write8(cycle_64);
-			write8(tcnt_64);
-			write8(cycle_74);
-			write8(tcnt_74);
-			write8(cycle_94);
-			write8(tcnt_94);
-			write8(cycle_10);
-			write8(tcnt_10);
-			serial0_send('>');
-			serial0_send('\n');
+			fmt_string("Done: <");
+			fmt_hex8(cycle_64);
+			fmt_hex8(tcnt_64);
+			fmt_hex8(cycle_74);
+			fmt_hex8(tcnt_74);
+			fmt_hex8(cycle_94);
+			fmt_hex8(tcnt_94);
+			fmt_hex8(cycle_10);
+			fmt_hex8(tcnt_10);
+			fmt_string(">\nFinito\n");
+			fmt_flush();
 			done = 1;
-			writeString("Finito\n");
 		}
 	}
 }